@@ -8,6 +8,7 @@
 #define __COAP_SERVER_CLIENT_INTRFACE_H__
 
 #define COAP_PORT 5683
+#define COAPS_PORT 5684
 
 /**@brief Enumeration describing light commands. */
 enum light_command {
@@ -18,5 +19,43 @@ enum light_command {
 #define PROVISIONING_URI_PATH "provisioning"
 #define LIGHT_URI_PATH "light"
 #define TEMPERATURE_URI_PATH "temperature"
+#define INFO_URI_PATH "info"
+#define SENSORS_URI_PATH "sensors"
+#define HISTORY_URI_PATH "history"
+#define LOG_URI_PATH "log"
+#define STATS_URI_PATH "stats"
+#define DIAG_URI_PATH "diag"
+#define SCHEDULE_URI_PATH "schedule"
+#define WELL_KNOWN_CORE_URI_PATH ".well-known/core"
+
+/* URI query asking the server to sample again instead of answering from its cache */
+#define FRESH_URI_QUERY "fresh"
+
+/* URI query selecting /sensors records by SenML name, may be repeated (e.g. "n=adc0") */
+#define SENSORS_NAME_URI_QUERY "n"
+#define SENSORS_ADC_NAME "adc"
+#define SENSORS_PUMP_REMAINING_NAME "light_remaining"
+
+/* URI query limiting /history to samples taken at or after an uptime, in ms */
+#define HISTORY_SINCE_URI_QUERY "since"
+
+/* /schedule payload: entries of SCHEDULE_ENTRY_SIZE bytes, a big-endian uint32 start
+ * and a big-endian uint16 duration, in seconds. A start with SCHEDULE_TIME_OF_DAY set
+ * is a time of day and runs every day, otherwise it is an offset from the upload and
+ * runs once. PUT replaces the whole schedule, an empty payload clears it.
+ */
+#define SCHEDULE_ENTRY_SIZE 6
+#define SCHEDULE_TIME_OF_DAY 0x80000000
+/* URI query giving the current time of day in seconds, needed once for time-of-day entries */
+#define SCHEDULE_TIME_URI_QUERY "t"
+
+/* Realm-local group addresses are this prefix with the group ID in the last 16 bits,
+ * group commands are NON PUTs on /light sent there.
+ */
+#define GROUP_ADDRESS_PREFIX "ff03::fd00:0"
+/* URI query naming the group a multicast command is for (e.g. "g=1") */
+#define GROUP_URI_QUERY "g"
+/* URI query bounding how long a light command lasts, in seconds */
+#define DURATION_URI_QUERY "d"
 
 #endif
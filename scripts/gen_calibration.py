@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""Generates the temperature calibration table of the sensor voltage.
+
+Run by CMake with the CONFIG_COAP_SERVER_CAL_* description of the sensor.
+The table maps mV to 0.01 degC, sorted by strictly increasing mV, and is
+interpolated linearly on the device in integer math:
+
+    gen_calibration.py --ntc R25 BETA SERIES SUPPLY_MV --range -40 125 --points 33 -o table.h
+    gen_calibration.py --linear OFFSET_MV UV_PER_DEG --range -40 125 -o table.h
+"""
+
+import argparse
+import math
+import sys
+
+KELVIN = 273.15
+T25 = 25.0 + KELVIN
+
+
+def ntc_mv(temp, r25, beta, series, supply_mv):
+    """Output of a divider with the NTC on the low side."""
+    r = r25 * math.exp(beta * (1.0 / (temp + KELVIN) - 1.0 / T25))
+    return supply_mv * r / (series + r)
+
+
+def linear_mv(temp, offset_mv, uv_per_deg):
+    return offset_mv + temp * uv_per_deg / 1000.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sensor = parser.add_mutually_exclusive_group(required=True)
+    sensor.add_argument("--ntc", nargs=4, type=int, metavar=("R25", "BETA", "SERIES", "SUPPLY_MV"),
+                        help="NTC thermistor (ohm, K, ohm, mV)")
+    sensor.add_argument("--linear", nargs=2, type=int, metavar=("OFFSET_MV", "UV_PER_DEG"),
+                        help="linear sensor: output at 0 degC and slope")
+    parser.add_argument("--range", nargs=2, type=int, default=(-40, 125),
+                        metavar=("MIN", "MAX"), help="degC")
+    parser.add_argument("--points", type=int, default=33,
+                        help="table size, a linear sensor only needs 2")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    low, high = args.range
+    if low >= high or args.points < 2:
+        parser.error("need MIN < MAX and at least 2 points")
+
+    if args.ntc:
+        points = args.points
+        mv = lambda temp: ntc_mv(temp, *args.ntc)
+        description = "NTC R25 %d ohm, beta %d K, series %d ohm, supply %d mV" % tuple(args.ntc)
+    else:
+        # exact with the two ends
+        points = 2
+        mv = lambda temp: linear_mv(temp, *args.linear)
+        description = "linear, %d mV at 0 degC, %d uV/degC" % tuple(args.linear)
+
+    table = {}
+    for i in range(points):
+        temp = low + (high - low) * i / (points - 1)
+        # neighbours rounding to the same mV carry no information
+        table.setdefault(round(mv(temp)), round(temp * 100))
+
+    if len(table) < 2:
+        parser.error("the sensor output does not change over the range")
+
+    with open(args.output, "w") as f:
+        f.write("/* Generated by gen_calibration.py, do not edit.\n")
+        f.write(" * %s, %d to %d degC\n */\n\n" % (description, low, high))
+        f.write("static const struct calibration_point calibration_table[] = {\n")
+        for point_mv in sorted(table):
+            f.write("\t{ %d, %d },\n" % (point_mv, table[point_mv]))
+        f.write("};\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
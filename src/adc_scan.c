@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/devicetree.h>
+
+#include "adc_scan.h"
+#include "adc_waveform.h"
+#include "coap_stats.h"
+#include "sampling.h"
+
+LOG_MODULE_REGISTER(adc_scan, CONFIG_SAMPLING_LOG_LEVEL);
+
+#if !DT_NODE_EXISTS(DT_PATH(zephyr_user)) || \
+	!DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+#error "No suitable devicetree overlay specified"
+#endif
+
+#define DT_SPEC_AND_COMMA(node_id, prop, idx) \
+	ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
+
+/* Data of ADC io-channels specified in devicetree. */
+static const struct adc_dt_spec adc_channels[] = {
+	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels,
+			     DT_SPEC_AND_COMMA)
+};
+
+BUILD_ASSERT(ARRAY_SIZE(adc_channels) == SAMPLING_NUM_CHANNELS);
+
+/* The SAADC averages a single channel only, the driver refuses a
+ * multi-channel sequence with oversampling.
+ */
+BUILD_ASSERT(CONFIG_COAP_SERVER_ADC_OVERSAMPLING == 0 || ARRAY_SIZE(adc_channels) == 1,
+	     "ADC oversampling needs a single io-channel, set COAP_SERVER_ADC_OVERSAMPLING to 0");
+
+/* One result per channel. The driver stores them in ascending channel_id
+ * order, which is not necessarily the devicetree order.
+ */
+static int16_t raw[ARRAY_SIZE(adc_channels)];
+static uint8_t raw_index[ARRAY_SIZE(adc_channels)];
+
+static struct adc_sequence sequence = {
+	.buffer = raw,
+	/* buffer size in bytes, not number of samples */
+	.buffer_size = sizeof(raw),
+};
+
+/* duration of a whole scan */
+static struct coap_stats_histogram scan_latency;
+
+#ifdef CONFIG_COAP_SERVER_ADC_ASYNC
+static struct k_poll_signal scan_done;
+static struct k_poll_event scan_event =
+	K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &scan_done);
+/* A scan timed out and still holds the ADC and writes into raw[], no new
+ * scan is started before its signal is raised.
+ */
+static bool scan_pending;
+#endif
+
+int adc_scan_init(void)
+{
+	int ret;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		if (!device_is_ready(adc_channels[i].dev)) {
+			LOG_ERR("ADC controller device not ready");
+			return -ENODEV;
+		}
+
+		/* a single sequence can only span one controller */
+		if (adc_channels[i].dev != adc_channels[0].dev) {
+			LOG_ERR("Channel #%d is not on the first ADC controller", i);
+			return -EINVAL;
+		}
+
+		ret = adc_channel_setup_dt(&adc_channels[i]);
+		if (ret < 0) {
+			LOG_ERR("Could not setup channel #%d (%d)", i, ret);
+			return ret;
+		}
+
+#ifdef CONFIG_ADC_EMUL
+		/* native_sim: the emulator converts a scripted waveform */
+		ret = adc_waveform_init(adc_channels[i].dev, adc_channels[i].channel_id);
+		if (ret < 0) {
+			return ret;
+		}
+#endif
+	}
+
+	/* resolution and oversampling come from the first channel, then every
+	 * other channel is added to the same scan
+	 */
+	ret = adc_sequence_init_dt(&adc_channels[0], &sequence);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		sequence.channels |= BIT(adc_channels[i].channel_id);
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		raw_index[i] = 0;
+		for (size_t j = 0U; j < ARRAY_SIZE(adc_channels); j++) {
+			if (adc_channels[j].channel_id < adc_channels[i].channel_id) {
+				raw_index[i]++;
+			}
+		}
+	}
+
+	if (CONFIG_COAP_SERVER_ADC_OVERSAMPLING > 0) {
+		sequence.oversampling = CONFIG_COAP_SERVER_ADC_OVERSAMPLING;
+	}
+
+	/* same limit for the zephyr,oversampling of the first channel node */
+	if (ARRAY_SIZE(adc_channels) > 1 && sequence.oversampling > 0) {
+		LOG_ERR("Oversampling %d of channel #0 needs a single-channel scan",
+			sequence.oversampling);
+		return -EINVAL;
+	}
+
+#ifdef CONFIG_COAP_SERVER_ADC_ASYNC
+	k_poll_signal_init(&scan_done);
+#endif
+
+	coap_stats_histogram_register(&scan_latency, "adc");
+
+	LOG_INF("ADC scan of %d channels (mask 0x%x), oversampling %d",
+		ARRAY_SIZE(adc_channels), sequence.channels, sequence.oversampling);
+
+	return 0;
+}
+
+static int adc_scan_convert(void)
+{
+#ifdef CONFIG_COAP_SERVER_ADC_ASYNC
+	unsigned int signaled;
+	int result;
+	int err;
+
+	if (scan_pending) {
+		k_poll_signal_check(&scan_done, &signaled, &result);
+		if (!signaled) {
+			return -EBUSY;
+		}
+
+		/* the late results are dropped, a new scan is started */
+		scan_pending = false;
+	}
+
+	k_poll_signal_reset(&scan_done);
+	scan_event.state = K_POLL_STATE_NOT_READY;
+
+	err = adc_read_async(adc_channels[0].dev, &sequence, &scan_done);
+	if (err < 0) {
+		return err;
+	}
+
+	/* a stuck conversion must not hang the sampling work queue */
+	err = k_poll(&scan_event, 1, K_MSEC(CONFIG_COAP_SERVER_ADC_ASYNC_TIMEOUT));
+	if (err == -EAGAIN) {
+		scan_pending = true;
+	}
+	if (err < 0) {
+		return err;
+	}
+
+	k_poll_signal_check(&scan_done, &signaled, &result);
+
+	return signaled ? result : -EIO;
+#else
+	return adc_read(adc_channels[0].dev, &sequence);
+#endif
+}
+
+int adc_scan_read(int32_t *val_mv)
+{
+	uint32_t start = k_cycle_get_32();
+	int err;
+
+	err = adc_scan_convert();
+	if (err < 0) {
+		LOG_ERR("Could not read (%d)", err);
+		coap_stats_inc(COAP_STATS_ADC_ERRORS);
+		return err;
+	}
+
+	coap_stats_record(&scan_latency, start);
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		/* conversion to mV may not be supported, keep the raw value if not */
+		val_mv[i] = raw[raw_index[i]];
+		err = adc_raw_to_millivolts_dt(&adc_channels[i], &val_mv[i]);
+		if (err < 0) {
+			LOG_DBG("Channel #%d value in mV not available", i);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __ADC_SCAN_H__
+#define __ADC_SCAN_H__
+
+#include <stdint.h>
+
+/**@brief Set up every io-channel of the zephyr,user node and build the scan sequence. */
+int adc_scan_init(void);
+
+/**@brief Convert all channels in one burst.
+ *
+ * @param val_mv array of SAMPLING_NUM_CHANNELS entries, in devicetree order,
+ *               filled with the value of each channel in mV.
+ */
+int adc_scan_read(int32_t *val_mv);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+
+#include "adc_waveform.h"
+
+LOG_MODULE_REGISTER(adc_waveform, CONFIG_SAMPLING_LOG_LEVEL);
+
+#define WAVEFORM_POINTS_MAX 16
+
+struct waveform_point {
+	uint32_t t_ms;
+	uint32_t mv;
+};
+
+static struct waveform_point points[WAVEFORM_POINTS_MAX];
+static size_t num_points;
+
+/* Parses "t_ms:mV,t_ms:mV,...", times must start at 0 and increase */
+static int waveform_parse(const char *script)
+{
+	const char *p = script;
+	char *end;
+
+	num_points = 0;
+
+	while (*p != '\0') {
+		struct waveform_point point;
+
+		if (num_points == ARRAY_SIZE(points)) {
+			return -ENOMEM;
+		}
+
+		point.t_ms = strtoul(p, &end, 10);
+		if (end == p || *end != ':') {
+			return -EINVAL;
+		}
+		p = end + 1;
+
+		point.mv = strtoul(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0')) {
+			return -EINVAL;
+		}
+		p = *end == ',' ? end + 1 : end;
+
+		if ((num_points == 0 && point.t_ms != 0) ||
+		    (num_points > 0 && point.t_ms <= points[num_points - 1].t_ms)) {
+			return -EINVAL;
+		}
+
+		points[num_points++] = point;
+	}
+
+	return num_points > 0 ? 0 : -EINVAL;
+}
+
+/* Called by the emulator for every conversion, in simulated time */
+static int waveform_value(const struct device *dev, unsigned int chan, void *data,
+			  uint32_t *result)
+{
+	uint32_t period = points[num_points - 1].t_ms;
+	uint32_t t = period > 0 ? k_uptime_get() % period : 0;
+
+	ARG_UNUSED(dev);
+	ARG_UNUSED(chan);
+	ARG_UNUSED(data);
+
+	for (size_t i = 1; i < num_points; i++) {
+		const struct waveform_point *a = &points[i - 1];
+		const struct waveform_point *b = &points[i];
+
+		if (t < b->t_ms) {
+			*result = a->mv + ((int64_t)b->mv - a->mv) * (t - a->t_ms) /
+						  (b->t_ms - a->t_ms);
+			return 0;
+		}
+	}
+
+	*result = points[num_points - 1].mv;
+
+	return 0;
+}
+
+int adc_waveform_init(const struct device *dev, uint8_t channel)
+{
+	int ret;
+
+	if (num_points == 0) {
+		ret = waveform_parse(CONFIG_COAP_SERVER_ADC_WAVEFORM);
+		if (ret < 0) {
+			LOG_ERR("Invalid waveform \"%s\"", CONFIG_COAP_SERVER_ADC_WAVEFORM);
+			return ret;
+		}
+		LOG_INF("Emulated ADC waveform of %d points", num_points);
+	}
+
+	return adc_emul_value_func_set(dev, channel, waveform_value, NULL);
+}
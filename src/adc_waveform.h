@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __ADC_WAVEFORM_H__
+#define __ADC_WAVEFORM_H__
+
+#include <stdint.h>
+#include <zephyr/device.h>
+
+/**@brief Drive an emulated ADC channel with CONFIG_COAP_SERVER_ADC_WAVEFORM. */
+int adc_waveform_init(const struct device *dev, uint8_t channel);
+
+#endif
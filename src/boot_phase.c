@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+
+#include "boot_phase.h"
+
+static const char *const phase_names[] = {
+	[BOOT_PHASE_MAIN] = "main",
+	[BOOT_PHASE_COAP] = "coap",
+	[BOOT_PHASE_THREAD] = "thread",
+	[BOOT_PHASE_SAMPLING] = "sampling",
+	[BOOT_PHASE_PERIPHERALS] = "peripherals",
+	[BOOT_PHASE_USB] = "usb",
+	[BOOT_PHASE_ATTACHED] = "attached",
+	[BOOT_PHASE_SRP] = "srp",
+	[BOOT_PHASE_FIRST_RESPONSE] = "first_response",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(phase_names) == BOOT_PHASE_COUNT);
+
+/* a phase bit is set once its time is written, readers need no lock */
+static atomic_t reached;
+static atomic_t failed;
+static uint32_t phase_ms[BOOT_PHASE_COUNT];
+static int phase_err[BOOT_PHASE_COUNT];
+
+void boot_phase_mark(enum boot_phase phase)
+{
+	if (atomic_test_bit(&reached, phase)) {
+		return;
+	}
+
+	phase_ms[phase] = k_uptime_get_32();
+	atomic_set_bit(&reached, phase);
+}
+
+void boot_phase_fail(enum boot_phase phase, int err)
+{
+	phase_err[phase] = err;
+	atomic_set_bit(&failed, phase);
+	boot_phase_mark(phase);
+}
+
+bool boot_phase_reached(enum boot_phase phase)
+{
+	return atomic_test_bit(&reached, phase) && !atomic_test_bit(&failed, phase);
+}
+
+const char *boot_phase_name(enum boot_phase phase)
+{
+	return phase_names[phase];
+}
+
+int32_t boot_phase_ms(enum boot_phase phase)
+{
+	return atomic_test_bit(&reached, phase) ? (int32_t)phase_ms[phase] : -1;
+}
+
+static int cmd_boot(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+		if (!atomic_test_bit(&reached, i)) {
+			shell_print(sh, "%-15s -", phase_names[i]);
+		} else if (atomic_test_bit(&failed, i)) {
+			shell_print(sh, "%-15s %6u ms  failed (%d)", phase_names[i], phase_ms[i],
+				    phase_err[i]);
+		} else {
+			shell_print(sh, "%-15s %6u ms", phase_names[i], phase_ms[i]);
+		}
+	}
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((coap), boot, NULL, "Uptime at which each startup phase completed", cmd_boot,
+		 1, 0);
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BOOT_PHASE_H__
+#define __BOOT_PHASE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**@brief Startup milestones, in the order they are usually reached. */
+enum boot_phase {
+	/* main() entered */
+	BOOT_PHASE_MAIN,
+	/* CoAP resources registered */
+	BOOT_PHASE_COAP,
+	/* OpenThread started, attach in progress */
+	BOOT_PHASE_THREAD,
+	/* ADC configured, sample log mounted and periodic sampling started */
+	BOOT_PHASE_SAMPLING,
+	/* LEDs and buttons */
+	BOOT_PHASE_PERIPHERALS,
+	BOOT_PHASE_USB,
+	/* first attach to a partition */
+	BOOT_PHASE_ATTACHED,
+	/* host and service registered with the SRP server */
+	BOOT_PHASE_SRP,
+	/* first 2.xx CoAP response sent */
+	BOOT_PHASE_FIRST_RESPONSE,
+	BOOT_PHASE_COUNT,
+};
+
+/**@brief Record the uptime of a phase. Only the first call of each phase counts.
+ * Safe from any thread.
+ */
+void boot_phase_mark(enum boot_phase phase);
+
+/**@brief Record the failure of a phase, the node carries on without it. */
+void boot_phase_fail(enum boot_phase phase, int err);
+
+/**@brief True once the phase is marked (and did not fail). */
+bool boot_phase_reached(enum boot_phase phase);
+
+/**@brief Name of a phase, for reports. */
+const char *boot_phase_name(enum boot_phase phase);
+
+/**@brief Uptime in ms at which the phase was marked, -1 if it was not reached. */
+int32_t boot_phase_ms(enum boot_phase phase);
+
+#endif
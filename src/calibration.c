@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/sys/util.h>
+
+#include "calibration.h"
+/* generated by scripts/gen_calibration.py */
+#include "calibration_table.h"
+
+BUILD_ASSERT(ARRAY_SIZE(calibration_table) >= 2);
+
+int32_t calibration_temperature(int32_t mv)
+{
+	const struct calibration_point *lo = &calibration_table[0];
+	const struct calibration_point *hi = &calibration_table[ARRAY_SIZE(calibration_table) - 1];
+
+	if (mv <= lo->mv) {
+		return lo->temperature;
+	}
+	if (mv >= hi->mv) {
+		return hi->temperature;
+	}
+
+	/* narrow down to the segment holding mv, the table is sorted by mV */
+	while (hi - lo > 1) {
+		const struct calibration_point *mid = lo + (hi - lo) / 2;
+
+		if (mid->mv <= mv) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo->temperature +
+	       (mv - lo->mv) * (hi->temperature - lo->temperature) / (hi->mv - lo->mv);
+}
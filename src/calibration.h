@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __CALIBRATION_H__
+#define __CALIBRATION_H__
+
+#include <stdint.h>
+
+/**@brief Point of the calibration table generated at build time from the
+ * CONFIG_COAP_SERVER_CAL_* description of the sensor.
+ */
+struct calibration_point {
+	int32_t mv;
+	/* 0.01 degC */
+	int32_t temperature;
+};
+
+/**@brief Temperature in 0.01 degC for a sensor voltage, interpolated in
+ * integer math and clamped to the range of the table.
+ */
+int32_t calibration_temperature(int32_t mv);
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/ip6.h>
+#include <coap_server_client_interface.h>
+
+#include "coap_group.h"
+
+LOG_MODULE_REGISTER(coap_group, CONFIG_OT_COAP_UTILS_LOG_LEVEL);
+
+static otInstance *ot;
+/* IDs of the groups joined, 0 for a free slot */
+static uint16_t groups[CONFIG_COAP_SERVER_GROUPS_MAX];
+static struct k_spinlock groups_lock;
+
+void coap_group_address(uint16_t id, otIp6Address *addr)
+{
+	(void)otIp6AddressFromString(GROUP_ADDRESS_PREFIX, addr);
+	sys_put_be16(id, &addr->mFields.m8[14]);
+}
+
+static int group_find(uint16_t id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(groups); i++) {
+		if (groups[i] == id) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+int coap_group_join(uint16_t id)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otIp6Address addr;
+	k_spinlock_key_t key;
+	otError error;
+	int slot;
+
+	if (id == 0) {
+		return -EINVAL;
+	}
+
+	if (group_find(id) >= 0) {
+		return -EALREADY;
+	}
+
+	slot = group_find(0);
+	if (slot < 0) {
+		return -ENOMEM;
+	}
+
+	coap_group_address(id, &addr);
+
+	openthread_api_mutex_lock(ot_context);
+	error = otIp6SubscribeMulticastAddress(ot, &addr);
+	openthread_api_mutex_unlock(ot_context);
+
+	if (error != OT_ERROR_NONE && error != OT_ERROR_ALREADY) {
+		LOG_ERR("Could not join group %u (%s)", id, otThreadErrorToString(error));
+		return -EIO;
+	}
+
+	key = k_spin_lock(&groups_lock);
+	groups[slot] = id;
+	k_spin_unlock(&groups_lock, key);
+
+	LOG_INF("Joined group %u", id);
+
+	return 0;
+}
+
+int coap_group_leave(uint16_t id)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otIp6Address addr;
+	k_spinlock_key_t key;
+	int slot;
+
+	slot = id != 0 ? group_find(id) : -ENOENT;
+	if (slot < 0) {
+		return slot;
+	}
+
+	key = k_spin_lock(&groups_lock);
+	groups[slot] = 0;
+	k_spin_unlock(&groups_lock, key);
+
+	coap_group_address(id, &addr);
+
+	openthread_api_mutex_lock(ot_context);
+	(void)otIp6UnsubscribeMulticastAddress(ot, &addr);
+	openthread_api_mutex_unlock(ot_context);
+
+	return 0;
+}
+
+bool coap_group_match(uint16_t id, const otIp6Address *addr)
+{
+	otIp6Address group_addr;
+	k_spinlock_key_t key;
+	bool member;
+
+	if (id == 0) {
+		return false;
+	}
+
+	key = k_spin_lock(&groups_lock);
+	member = group_find(id) >= 0;
+	k_spin_unlock(&groups_lock, key);
+
+	coap_group_address(id, &group_addr);
+
+	return member && otIp6IsAddressEqual(addr, &group_addr);
+}
+
+int coap_group_init(otInstance *instance)
+{
+	const char *ids = CONFIG_COAP_SERVER_GROUPS;
+	char *end;
+
+	ot = instance;
+
+	/* comma-separated group IDs */
+	while (*ids != '\0') {
+		unsigned long id = strtoul(ids, &end, 0);
+
+		if (end == ids || id == 0 || id > UINT16_MAX || (*end != ',' && *end != '\0')) {
+			LOG_ERR("Invalid group list \"%s\"", CONFIG_COAP_SERVER_GROUPS);
+			return -EINVAL;
+		}
+
+		(void)coap_group_join(id);
+		ids = *end == ',' ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+static int cmd_group(const struct shell *sh, size_t argc, char **argv)
+{
+	char addr_str[OT_IP6_ADDRESS_STRING_SIZE];
+	otIp6Address addr;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	for (size_t i = 0; i < ARRAY_SIZE(groups); i++) {
+		uint16_t id = groups[i];
+
+		if (id == 0) {
+			continue;
+		}
+		coap_group_address(id, &addr);
+		otIp6AddressToString(&addr, addr_str, sizeof(addr_str));
+		shell_print(sh, "%5u %s", id, addr_str);
+	}
+
+	return 0;
+}
+
+static int cmd_group_update(const struct shell *sh, char **argv, bool join)
+{
+	unsigned long id = strtoul(argv[1], NULL, 0);
+	int err;
+
+	if (id == 0 || id > UINT16_MAX) {
+		shell_error(sh, "Group IDs are 1 to %u", UINT16_MAX);
+		return -EINVAL;
+	}
+
+	err = join ? coap_group_join(id) : coap_group_leave(id);
+	if (err) {
+		shell_error(sh, "Could not %s group %lu (%d)", join ? "join" : "leave", id, err);
+	}
+
+	return err;
+}
+
+static int cmd_group_join(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+
+	return cmd_group_update(sh, argv, true);
+}
+
+static int cmd_group_leave(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+
+	return cmd_group_update(sh, argv, false);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_group,
+	SHELL_CMD_ARG(join, NULL, "Join a group: join <id>", cmd_group_join, 2, 0),
+	SHELL_CMD_ARG(leave, NULL, "Leave a group: leave <id>", cmd_group_leave, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((coap), group, &sub_group, "List the multicast groups joined", cmd_group, 1, 0);
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_GROUP_H__
+#define __COAP_GROUP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/instance.h>
+#include <openthread/ip6.h>
+
+/**@brief Subscribe to the groups of CONFIG_COAP_SERVER_GROUPS. */
+int coap_group_init(otInstance *ot);
+
+/**@brief Realm-local address of a group: GROUP_ADDRESS_PREFIX with the ID in the last 16 bits. */
+void coap_group_address(uint16_t id, otIp6Address *addr);
+
+/**@brief Subscribe to the address of a group. Takes the OpenThread API lock. */
+int coap_group_join(uint16_t id);
+
+/**@brief Unsubscribe from the address of a group. Takes the OpenThread API lock. */
+int coap_group_leave(uint16_t id);
+
+/**@brief True if the node is a member of the group and addr is its address. */
+bool coap_group_match(uint16_t id, const otIp6Address *addr);
+
+#endif
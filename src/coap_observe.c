@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+#include <openthread/message.h>
+
+#include "coap_observe.h"
+#include "coap_trace.h"
+
+LOG_MODULE_REGISTER(coap_observe, CONFIG_OT_COAP_UTILS_LOG_LEVEL);
+
+#define OBSERVE_REGISTER 0
+#define OBSERVE_DEREGISTER 1
+#define OBSERVE_SEQ_MASK 0xFFFFFF
+#define NOTIFICATION_PAYLOAD_MAX_SIZE 32
+
+struct observer {
+	const struct coap_observable *res;
+	otIp6Address addr;
+	uint16_t port;
+	uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+	uint8_t token_len;
+	/* identifies the registration in CON notification callbacks */
+	uint16_t id;
+	/* notification attributes, in seconds (pmin/pmax) and value units (step) */
+	uint16_t pmin;
+	uint16_t pmax;
+	int32_t step;
+	uint16_t format;
+	int32_t last_value;
+	int64_t last_notify;
+	uint16_t notify_count;
+};
+
+static otInstance *ot;
+static struct observer observers[CONFIG_COAP_SERVER_OBSERVERS_MAX];
+static uint32_t observe_seq;
+static uint16_t next_id = 1;
+
+static void notify_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(notify_work, notify_work_handler);
+
+static bool observer_match(const struct observer *obs, const struct coap_observable *res,
+			   const otMessageInfo *message_info)
+{
+	return obs->res == res && obs->port == message_info->mPeerPort &&
+	       otIp6IsAddressEqual(&obs->addr, &message_info->mPeerAddr);
+}
+
+/* Parses a step such as "0.5" into value units */
+static int32_t observer_parse_step(const char *str, int32_t scale)
+{
+	char *end;
+	int32_t step;
+
+	scale = MAX(scale, 1);
+	step = abs((int32_t)strtol(str, &end, 10)) * scale;
+
+	if (*end == '.') {
+		// one more decimal per factor of ten of the scale, the rest is ignored
+		for (int32_t unit = scale / 10; unit > 0 && isdigit((unsigned char)*++end);
+		     unit /= 10) {
+			step += (*end - '0') * unit;
+		}
+	}
+
+	return step;
+}
+
+/* Parses the "pmin=", "pmax=" and "st=" URI queries */
+static void observer_parse_attributes(struct observer *obs, const struct coap_request *request)
+{
+	const char *query = NULL;
+
+	obs->pmin = 0;
+	obs->pmax = CONFIG_COAP_SERVER_OBSERVE_PMAX;
+	obs->step = 0;
+
+	while ((query = coap_request_query_next(request, query)) != NULL) {
+		if (strncmp(query, "pmin=", 5) == 0) {
+			obs->pmin = strtoul(&query[5], NULL, 10);
+		} else if (strncmp(query, "pmax=", 5) == 0) {
+			obs->pmax = strtoul(&query[5], NULL, 10);
+		} else if (strncmp(query, "st=", 3) == 0) {
+			obs->step = observer_parse_step(&query[3], obs->res->scale);
+		}
+	}
+
+	/* a heartbeat is always needed to keep the Max-Age of the last notification valid */
+	if (obs->pmax == 0 || obs->pmax < obs->pmin) {
+		obs->pmax = MAX(obs->pmin, CONFIG_COAP_SERVER_OBSERVE_PMAX);
+	}
+}
+
+otError coap_observe_request(const struct coap_observable *res, const struct coap_request *request,
+			     otMessage *response, int32_t value, uint16_t format)
+{
+	const otMessageInfo *message_info = &request->message_info;
+	uint32_t observe = request->observe;
+	struct observer *obs = NULL;
+	struct observer *free_slot = NULL;
+
+	if (!request->has_observe) {
+		return OT_ERROR_NONE;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observers[i].res == NULL) {
+			if (free_slot == NULL) {
+				free_slot = &observers[i];
+			}
+		} else if (observer_match(&observers[i], res, message_info)) {
+			obs = &observers[i];
+			break;
+		}
+	}
+
+	if (observe == OBSERVE_DEREGISTER) {
+		if (obs != NULL) {
+			coap_trace(COAP_TRACE_OBSERVE_DEREGISTER, res->uri, 0, 0);
+			obs->res = NULL;
+		}
+		return OT_ERROR_NONE;
+	}
+
+	if (observe != OBSERVE_REGISTER) {
+		return OT_ERROR_NONE;
+	}
+
+	if (obs == NULL) {
+		obs = free_slot;
+	}
+
+	if (obs == NULL) {
+		/* table full: answer as a plain GET, the client sees no Observe option */
+		LOG_WRN("No room for another observer of /%s", res->uri);
+		return OT_ERROR_NONE;
+	}
+
+	obs->res = res;
+	obs->addr = message_info->mPeerAddr;
+	obs->port = message_info->mPeerPort;
+	obs->token_len = request->token_len;
+	memcpy(obs->token, request->token, obs->token_len);
+	obs->id = next_id++;
+	obs->format = format;
+	obs->last_value = value;
+	obs->last_notify = k_uptime_get();
+	obs->notify_count = 0;
+	observer_parse_attributes(obs, request);
+
+	coap_trace(COAP_TRACE_OBSERVE_REGISTER, obs->res->uri, obs->pmin, obs->pmax);
+
+	/* schedule the heartbeat of the new observer */
+	k_work_reschedule(&notify_work, K_NO_WAIT);
+
+	observe_seq = (observe_seq + 1) & OBSERVE_SEQ_MASK;
+
+	return otCoapMessageAppendObserveOption(response, observe_seq);
+}
+
+static void con_notification_handler(void *context, otMessage *message,
+				     const otMessageInfo *message_info, otError result)
+{
+	uint16_t id = (uint16_t)(uintptr_t)context;
+
+	ARG_UNUSED(message);
+	ARG_UNUSED(message_info);
+
+	if (result == OT_ERROR_NONE) {
+		return;
+	}
+
+	/* no ACK or a RST: the client is gone (RFC 7641, 4.5) */
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observers[i].res != NULL && observers[i].id == id) {
+			LOG_INF("Observer of /%s dropped (%s)", observers[i].res->uri,
+				otThreadErrorToString(result));
+			observers[i].res = NULL;
+		}
+	}
+}
+
+static otError notification_send(struct observer *obs, int32_t value)
+{
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *notification = NULL;
+	otMessageInfo message_info;
+	uint8_t payload[NOTIFICATION_PAYLOAD_MAX_SIZE];
+	bool confirmable;
+	int len;
+
+	len = obs->res->serialize(value, obs->format, payload, sizeof(payload));
+	if (len < 0) {
+		goto end;
+	}
+
+	/* every Nth notification is confirmable, to find out if the client is still there */
+	confirmable = (++obs->notify_count % CONFIG_COAP_SERVER_OBSERVE_CON_INTERVAL) == 0;
+
+	notification = otCoapNewMessage(ot, NULL);
+	if (notification == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(notification,
+			  confirmable ? OT_COAP_TYPE_CONFIRMABLE : OT_COAP_TYPE_NON_CONFIRMABLE,
+			  OT_COAP_CODE_CONTENT);
+
+	error = otCoapMessageSetToken(notification, obs->token, obs->token_len);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	observe_seq = (observe_seq + 1) & OBSERVE_SEQ_MASK;
+
+	error = otCoapMessageAppendObserveOption(notification, observe_seq);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	/* same format as the registration response; raw ones carry no Content-Format */
+	if (obs->format != OT_COAP_OPTION_CONTENT_FORMAT_OCTET_STREAM) {
+		error = otCoapMessageAppendContentFormatOption(notification, obs->format);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	/* the next notification is due within pmax at the latest */
+	error = otCoapMessageAppendMaxAgeOption(notification, obs->pmax);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(notification);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(notification, payload, len);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = obs->addr;
+	message_info.mPeerPort = obs->port;
+
+	error = otCoapSendRequest(ot, notification, &message_info,
+				  confirmable ? con_notification_handler : NULL,
+				  (void *)(uintptr_t)obs->id);
+	if (error == OT_ERROR_NONE) {
+		coap_trace(COAP_TRACE_OBSERVE_NOTIFY, obs->res->uri, confirmable, value);
+	}
+
+end:
+	if (error != OT_ERROR_NONE && notification != NULL) {
+		otMessageFree(notification);
+	}
+
+	return error;
+}
+
+static bool observer_value_changed(const struct observer *obs, int32_t value)
+{
+	if (obs->step == 0) {
+		return value != obs->last_value;
+	}
+
+	return abs(value - obs->last_value) >= obs->step;
+}
+
+/* Sends the notifications that are due and schedules the next evaluation */
+static void notify_work_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	int64_t now = k_uptime_get();
+	int64_t next = INT64_MAX;
+
+	ARG_UNUSED(work);
+
+	openthread_api_mutex_lock(ot_context);
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		struct observer *obs = &observers[i];
+		int64_t elapsed;
+		int32_t value;
+		bool changed;
+
+		if (obs->res == NULL || obs->res->read(&value) != 0) {
+			continue;
+		}
+
+		elapsed = now - obs->last_notify;
+		changed = observer_value_changed(obs, value);
+
+		if ((changed && elapsed >= obs->pmin * MSEC_PER_SEC) ||
+		    elapsed >= obs->pmax * MSEC_PER_SEC) {
+			if (notification_send(obs, value) == OT_ERROR_NONE) {
+				obs->last_value = value;
+				changed = false;
+			} else {
+				LOG_WRN("Could not notify observer of /%s", obs->res->uri);
+			}
+			/* on failure, retry at the next heartbeat rather than spinning */
+			obs->last_notify = now;
+		}
+
+		next = MIN(next, obs->last_notify + obs->pmax * MSEC_PER_SEC);
+		if (changed) {
+			next = MIN(next, obs->last_notify + obs->pmin * MSEC_PER_SEC);
+		}
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	if (next != INT64_MAX) {
+		k_work_reschedule(&notify_work, K_MSEC(MAX(next - now, 0)));
+	}
+}
+
+void coap_observe_notify(const struct coap_observable *res)
+{
+	ARG_UNUSED(res);
+
+	/* the handler evaluates every observer, a reschedule is enough */
+	k_work_reschedule(&notify_work, K_NO_WAIT);
+}
+
+int coap_observe_count(void)
+{
+	int count = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observers[i].res != NULL) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int coap_observe_init(otInstance *instance)
+{
+	ot = instance;
+	memset(observers, 0, sizeof(observers));
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_OBSERVE_H__
+#define __COAP_OBSERVE_H__
+
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "coap_request.h"
+
+/**@brief Resource that can be observed (RFC 7641). */
+struct coap_observable {
+	const char *uri;
+	/* current value, compared against the step attribute of each observer */
+	int (*read)(int32_t *value);
+	/* value units per unit of the step attribute, 0 for 1 */
+	int32_t scale;
+	/* writes the payload carrying value in the given content format into buf,
+	 * returns its length or a negative error code
+	 */
+	int (*serialize)(int32_t value, uint16_t format, uint8_t *buf, size_t size);
+};
+
+int coap_observe_init(otInstance *ot);
+
+/**@brief Handle the Observe option of a GET request.
+ *
+ * Registers or deregisters the sender and, when registered, appends the
+ * Observe option to the response. Must be called with the OpenThread API
+ * lock held, after the token is set and before any option numbered above
+ * Observe (6) is appended.
+ *
+ * @param value  value carried by the response, the baseline for notifications.
+ * @param format content format negotiated for the response, reused for notifications.
+ */
+otError coap_observe_request(const struct coap_observable *res, const struct coap_request *request,
+			     otMessage *response, int32_t value, uint16_t format);
+
+/**@brief Signal that the value of res may have changed. Safe from any context. */
+void coap_observe_notify(const struct coap_observable *res);
+
+/**@brief Number of registered observers. */
+int coap_observe_count(void);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "coap_request.h"
+
+static int option_uint_get(otCoapOptionIterator *iterator, uint32_t *value)
+{
+	uint64_t uint_value;
+
+	if (otCoapOptionIteratorGetOptionUintValue(iterator, &uint_value) != OT_ERROR_NONE) {
+		return -EINVAL;
+	}
+
+	*value = (uint32_t)uint_value;
+
+	return 0;
+}
+
+int coap_request_parse(struct coap_request *request, const otMessage *message,
+		       const otMessageInfo *message_info)
+{
+	otCoapOptionIterator iterator;
+	const otCoapOption *option;
+	uint8_t etag[sizeof(request->etags[0])];
+	uint32_t accept;
+	uint32_t no_response;
+	uint16_t payload_len;
+
+	memset(request, 0, sizeof(*request));
+
+	/* answer from the address the request was sent to, unless it was multicast */
+	request->message_info = *message_info;
+	request->destination = message_info->mSockAddr;
+	request->multicast = message_info->mSockAddr.mFields.m8[0] == 0xff;
+	if (request->multicast) {
+		/* the stack picks a unicast source address */
+		memset(&request->message_info.mSockAddr, 0, sizeof(request->message_info.mSockAddr));
+	}
+
+	request->type = otCoapMessageGetType(message);
+	request->code = otCoapMessageGetCode(message);
+	request->token_len = otCoapMessageGetTokenLength(message);
+	memcpy(request->token, otCoapMessageGetToken(message), request->token_len);
+
+	if (otCoapOptionIteratorInit(&iterator, message) != OT_ERROR_NONE) {
+		return -EINVAL;
+	}
+
+	for (option = otCoapOptionIteratorGetFirstOption(&iterator); option != NULL;
+	     option = otCoapOptionIteratorGetNextOption(&iterator)) {
+		switch (option->mNumber) {
+		case OT_COAP_OPTION_ACCEPT:
+			if (option_uint_get(&iterator, &accept) == 0) {
+				request->has_accept = true;
+				request->accept = accept;
+			}
+			break;
+
+		case OT_COAP_OPTION_OBSERVE:
+			request->has_observe = option_uint_get(&iterator, &request->observe) == 0;
+			break;
+
+		case OT_COAP_OPTION_BLOCK2:
+			request->has_block2 = option_uint_get(&iterator, &request->block2) == 0;
+			break;
+
+		case OT_COAP_OPTION_E_TAG:
+			if (option->mLength == sizeof(etag) &&
+			    request->etag_count < ARRAY_SIZE(request->etags) &&
+			    otCoapOptionIteratorGetOptionValue(&iterator, etag) == OT_ERROR_NONE) {
+				request->etags[request->etag_count++] = sys_get_be32(etag);
+			}
+			break;
+
+		case COAP_OPTION_NO_RESPONSE:
+			if (option_uint_get(&iterator, &no_response) == 0) {
+				request->has_no_response = true;
+				request->no_response = no_response;
+			}
+			break;
+
+		case OT_COAP_OPTION_URI_QUERY:
+			if (request->queries_len + option->mLength + 1 > sizeof(request->queries)) {
+				return -ENOMEM;
+			}
+			if (otCoapOptionIteratorGetOptionValue(
+				    &iterator, &request->queries[request->queries_len]) != OT_ERROR_NONE) {
+				return -EINVAL;
+			}
+			request->queries_len += option->mLength;
+			request->queries[request->queries_len++] = '\0';
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	payload_len = otMessageGetLength(message) - otMessageGetOffset(message);
+	if (payload_len > sizeof(request->payload)) {
+		return -EMSGSIZE;
+	}
+
+	request->payload_len = otMessageRead(message, otMessageGetOffset(message), request->payload,
+					     payload_len);
+
+	return 0;
+}
+
+const char *coap_request_query_next(const struct coap_request *request, const char *query)
+{
+	if (query == NULL) {
+		query = request->queries;
+	} else {
+		query += strlen(query) + 1;
+	}
+
+	return query < &request->queries[request->queries_len] ? query : NULL;
+}
+
+bool coap_request_query(const struct coap_request *request, const char *key, char *value,
+			size_t size)
+{
+	const char *query = NULL;
+	size_t len = strlen(key);
+
+	while ((query = coap_request_query_next(request, query)) != NULL) {
+		if (strncmp(query, key, len) != 0 || (query[len] != '\0' && query[len] != '=')) {
+			continue;
+		}
+
+		if (value != NULL && size > 0) {
+			strncpy(value, query[len] == '=' ? &query[len + 1] : "", size - 1);
+			value[size - 1] = '\0';
+		}
+		return true;
+	}
+
+	return false;
+}
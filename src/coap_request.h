@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_REQUEST_H__
+#define __COAP_REQUEST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+#include <coap_server_client_interface.h>
+
+/**@brief Room for the Uri-Query options of a request, each one NUL-terminated. */
+#define COAP_REQUEST_QUERIES_SIZE 64
+/**@brief Largest request payload, a full /schedule upload. */
+#define COAP_REQUEST_PAYLOAD_SIZE (SCHEDULE_ENTRY_SIZE * CONFIG_COAP_SERVER_SCHEDULE_ENTRIES)
+/**@brief Number of 4-byte ETag options kept, longer ones never match ours. */
+#define COAP_REQUEST_ETAGS_MAX 2
+/**@brief No-Response option number (RFC 7967), not known to OpenThread. */
+#define COAP_OPTION_NO_RESPONSE 258
+
+/**@brief Everything the resources need from a request, copied out of the
+ * otMessage so that it can be handled after the OpenThread callback returned.
+ */
+struct coap_request {
+	/* peer of the request, with the local address cleared for multicast requests */
+	otMessageInfo message_info;
+	/* address the request was sent to */
+	otIp6Address destination;
+	bool multicast;
+	/* received over CoAPS, set by the caller of coap_request_parse() */
+	bool secure;
+	otCoapType type;
+	otCoapCode code;
+	uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+	uint8_t token_len;
+	bool has_accept;
+	uint16_t accept;
+	bool has_observe;
+	uint32_t observe;
+	bool has_block2;
+	uint32_t block2;
+	uint8_t etag_count;
+	uint32_t etags[COAP_REQUEST_ETAGS_MAX];
+	/* RFC 7967 No-Response bits */
+	bool has_no_response;
+	uint8_t no_response;
+	uint8_t queries_len;
+	char queries[COAP_REQUEST_QUERIES_SIZE];
+	uint8_t payload_len;
+	uint8_t payload[COAP_REQUEST_PAYLOAD_SIZE];
+};
+
+/**@brief Copy a request out of its message.
+ *
+ * @retval -ENOMEM   the Uri-Query options do not fit.
+ * @retval -EMSGSIZE the payload does not fit.
+ */
+int coap_request_parse(struct coap_request *request, const otMessage *message,
+		       const otMessageInfo *message_info);
+
+/**@brief Iterate over the Uri-Query options: start with NULL, then pass the previous query.
+ *
+ * @return The next query as a string, NULL after the last one.
+ */
+const char *coap_request_query_next(const struct coap_request *request, const char *query);
+
+/**@brief Look for a "key" or "key=value" URI query. If value is not NULL, the
+ * part after '=' is copied there as a string.
+ *
+ * @return True if the query is present.
+ */
+bool coap_request_query(const struct coap_request *request, const char *key, char *value,
+			size_t size);
+
+#endif
@@ -12,30 +12,20 @@
 #include <openthread/thread.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/usb/usb_device.h>
-#include <openthread/srp_client.h>
-#include <openthread/srp_client_buffers.h>
-#include <zephyr/random/rand32.h>
-
-#include <zephyr/device.h>
-#include <zephyr/drivers/adc.h>
-#include <zephyr/devicetree.h>
 
+#include "adc_scan.h"
+#include "boot_phase.h"
+#include "calibration.h"
+#include "mesh_diag.h"
 #include "ot_coap_utils.h"
+#include "ot_srp.h"
 #include "ot_srp_config.h"
-
-#if !DT_NODE_EXISTS(DT_PATH(zephyr_user)) || \
-	!DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
-#error "No suitable devicetree overlay specified"
-#endif
-
-#define DT_SPEC_AND_COMMA(node_id, prop, idx) \
-	ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
-
-/* Data of ADC io-channels specified in devicetree. */
-static const struct adc_dt_spec adc_channels[] = {
-	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels,
-			     DT_SPEC_AND_COMMA)
-};
+#include "pump_schedule.h"
+#include "sample_history.h"
+#include "sample_log.h"
+#include "sampling.h"
+#include "sleepy.h"
+#include "telemetry.h"
 
 LOG_MODULE_REGISTER(coap_server, CONFIG_COAP_SERVER_LOG_LEVEL);
 
@@ -44,59 +34,39 @@ LOG_MODULE_REGISTER(coap_server, CONFIG_COAP_SERVER_LOG_LEVEL);
 #define LIGHT_LED DK_LED4
 
 #define PUMP_MAX_ACTIVE_TIME 10 // seconds
-#define ADC_TIMER_PERIOD 10 // seconds
+#define TEMPERATURE_ADC_CHANNEL 0 // index in the zephyr,user io-channels
 
 // FW version
 const char fw_version[] = SRP_CLIENT_INFO;
 
-// ADC globals
-uint16_t buf;
-struct adc_sequence sequence = {
-	.buffer = &buf,
-	/* buffer size in bytes, not number of samples */
-	.buffer_size = sizeof(buf),
-};
-
-struct fw_version {
-	// FW version
-	const char * fw_version_buf;
-	uint8_t fw_version_size;
-};
-
 struct fw_version fw = {
 	.fw_version_buf = fw_version,
 	.fw_version_size = sizeof(fw_version),
 };
 
-int16_t temperature = 0;
+/* 0.01 degC */
+int32_t temperature = 0;
 
 /* timer */
 static struct k_timer pump_timer;
-static struct k_timer adc_timer;
-
-/* hostname */
-const char hostname[] = SRP_CLIENT_HOSTNAME;
-const char service_instance[] = SRP_CLIENT_SERVICE_INSTANCE;
-#ifdef SRP_CLIENT_RNG
-char realhostname[sizeof(hostname)+SRP_CLIENT_RAND_SIZE+1] = {0};
-char realinstance[sizeof(service_instance)+SRP_CLIENT_RAND_SIZE+1] = {0};
-#elif SRP_CLIENT_UNIQUE
-char realhostname[sizeof(hostname)+SRP_CLIENT_UNIQUE_SIZE+1] = {0};
-char realinstance[sizeof(service_instance)+SRP_CLIENT_UNIQUE_SIZE+1] = {0};
-#endif
-
-const char service_name[] = SRP_SERVICE_NAME;
 
 struct fw_version on_info_request()
 {
 	return fw;
 }
 
-static void on_light_request(uint8_t command)
+static void on_light_request(uint8_t command, uint32_t duration_s)
 {
 	switch (command) {
 	case THREAD_COAP_UTILS_LIGHT_CMD_ON:
-		if (coap_is_pump_active() == false)
+		if (duration_s != 0) {
+			/* an explicit duration (re)starts the timer even if the pump already runs */
+			coap_activate_pump();
+			dk_set_led_on(LIGHT_LED);
+			k_timer_start(&pump_timer,
+				      K_SECONDS(MIN(duration_s, CONFIG_COAP_SERVER_PUMP_MAX_DURATION)),
+				      K_NO_WAIT);
+		} else if (coap_is_pump_active() == false)
 		{
 			coap_activate_pump();
 			dk_set_led_on(LIGHT_LED);
@@ -118,36 +88,63 @@ static void on_light_request(uint8_t command)
 	}
 }
 
+/* Timer ISR of the pump schedule, the run is bounded by the pump timer */
+static void on_schedule_run(uint32_t duration_s)
+{
+	on_light_request(THREAD_COAP_UTILS_LIGHT_CMD_ON, duration_s);
+}
 
-static int8_t on_temperature_request()
+static int on_temperature_request(bool fresh, int32_t *val, uint32_t *max_age)
 {
-	int err;
-	int32_t val_mv;
+	struct sample_set set;
+	uint32_t age;
 
-	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+	if (!boot_phase_reached(BOOT_PHASE_SAMPLING)) {
+		/* served before the ADC is up, or without it */
+		return -EAGAIN;
+	}
 
-		(void)adc_sequence_init_dt(&adc_channels[i], &sequence);
+	if (fresh) {
+		(void)sampling_refresh();
+	}
 
-		err = adc_read(adc_channels[i].dev, &sequence);
-		if (err < 0) {
-			LOG_ERR("Could not read (%d)\n", err);
-			continue;
-		}
+	sampling_get(&set);
+	if (!set.valid) {
+		return -EAGAIN;
+	}
 
-		/* conversion to mV may not be supported, skip if not */
-		val_mv = buf;
-		err = adc_raw_to_millivolts_dt(&adc_channels[i],
-							&val_mv);
-		if (err < 0) {
-			LOG_ERR(" (value in mV not available)\n");
-		}
+	age = sampling_age_ms(&set) / MSEC_PER_SEC;
+	if (age >= CONFIG_COAP_SERVER_SAMPLE_MAX_AGE) {
+		/* serve the stale value right away, refresh for the next request */
+		sampling_trigger();
+		*max_age = 0;
+	} else {
+		*max_age = CONFIG_COAP_SERVER_SAMPLE_MAX_AGE - age;
 	}
 
-	temperature = (uint8_t)val_mv;
+	*val = set.temperature;
 
-	LOG_INF("Temperature is %d\n", temperature);	
+	return 0;
+}
 
-	return temperature;
+static int on_sensors_request(bool fresh, struct sample_set *set, uint32_t *pump_remaining_ms)
+{
+	if (!boot_phase_reached(BOOT_PHASE_SAMPLING)) {
+		return -EAGAIN;
+	}
+
+	if (fresh) {
+		(void)sampling_refresh();
+	}
+
+	sampling_get(set);
+	if (!set->valid) {
+		return -EAGAIN;
+	}
+
+	*pump_remaining_ms = coap_is_pump_active() ? k_timer_remaining_get(&pump_timer) : 0;
+
+	return 0;
 }
 
 static void on_button_changed(uint32_t button_state, uint32_t has_changed)
@@ -159,101 +156,18 @@ static void on_button_changed(uint32_t button_state, uint32_t has_changed)
 	}
 }
 
-void srp_client_generate_name()
-{
-	#ifdef SRP_CLIENT_UNIQUE
-		LOG_INF("Appending device ID to hostname");
-		// first copy the hostname and service instance defined defined by SRP_CLIENT_HOSTNAME and SRP_CLIENT_SERVICE_INSTANCE, respectively
-		memcpy(realhostname, hostname, sizeof(hostname));
-		memcpy(realinstance, service_instance, sizeof(service_instance));
-		// get a device ID
-		uint32_t device_id = NRF_FICR->DEVICEID[0];
-		// append the random number as a string to the hostname and service_instance buffers (numbe of digits is defined by SRP_CLIENT_RAND_SIZE)
-		snprintf(realhostname+sizeof(hostname)-1, SRP_CLIENT_UNIQUE_SIZE+2, "-%x", device_id);
-		snprintf(realinstance+sizeof(service_instance)-1, SRP_CLIENT_UNIQUE_SIZE+2, "-%x", device_id);
-		LOG_INF("hostname is: %s\n", realhostname);
-		LOG_INF("service instance is: %s\n", realinstance);
-	#elif SRP_CLIENT_RNG
-		LOG_INF("Appending random number to hostname");
-		/* append a random number of size SRP_CLIENT_RAND_SIZE to the service hostname and service instance string buffers */
-		// first copy the hostname and service instance defined defined by SRP_CLIENT_HOSTNAME and SRP_CLIENT_SERVICE_INSTANCE, respectively
-		memcpy(realhostname, hostname, sizeof(hostname));
-		memcpy(realinstance, service_instance, sizeof(service_instance));
-		// get a random uint32_t (true random, hw based)
-		uint32_t rn = sys_rand32_get();
-		// append the random number as a string to the hostname and service_instance buffers (numbe of digits is defined by SRP_CLIENT_RAND_SIZE)
-		snprintf(realhostname+sizeof(hostname)-1, SRP_CLIENT_RAND_SIZE+2, "-%x", rn);
-		snprintf(realinstance+sizeof(service_instance)-1, SRP_CLIENT_RAND_SIZE+2, "-%x", rn);
-		LOG_INF("hostname is: %s\n", realhostname);
-		LOG_INF("service instance is: %s\n", realinstance);
-	#else
-		LOG_INF("hostname is: %s\n", hostname);
-		LOG_INF("service instance is: %s\n", service_instance);
-	#endif
-}
-
-void on_srp_client_updated(otError aError, const otSrpClientHostInfo *aHostInfo, const otSrpClientService *aServices, const otSrpClientService *aRemovedServices, void *aContext);
-
-void on_srp_client_updated(otError aError, const otSrpClientHostInfo *aHostInfo, const otSrpClientService *aServices, const otSrpClientService *aRemovedServices, void *aContext)
-{
-	LOG_INF("SRP callback: %s", otThreadErrorToString(aError));
-}
-
 static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
 				    void *user_data)
 {
-	static uint8_t oneTime = 0;
 	if (flags & OT_CHANGED_THREAD_ROLE) {
+		mesh_diag_role_changed();
+
 		switch (otThreadGetDeviceRole(ot_context->instance)) {
 		case OT_DEVICE_ROLE_CHILD:
 		case OT_DEVICE_ROLE_ROUTER:
 		case OT_DEVICE_ROLE_LEADER:
+			boot_phase_mark(BOOT_PHASE_ATTACHED);
 			dk_set_led_on(OT_CONNECTION_LED);
-			otSrpClientBuffersServiceEntry *entry = NULL;
-			uint16_t                        size;
-			char                           *string;
-			if (!oneTime)
-			{
-				oneTime = 1;
-
-				// set the SRP update callback
-				otSrpClientSetCallback(openthread_get_default_instance(), on_srp_client_updated, NULL);
-				// set the service hostname
-				#if defined SRP_CLIENT_RNG || defined SRP_CLIENT_UNIQUE
-				if (otSrpClientSetHostName(openthread_get_default_instance(), realhostname) != OT_ERROR_NONE)
-				#else
-				if (otSrpClientSetHostName(openthread_get_default_instance(), hostname) != OT_ERROR_NONE)
-				#endif
-					LOG_INF("Cannot set SRP host name");
-				// set address to auto
-				if (otSrpClientEnableAutoHostAddress(openthread_get_default_instance()) != OT_ERROR_NONE)
-					LOG_INF("Cannot set SRP host address to auto");
-				// allocate service buffers from OT SRP API
-				entry = otSrpClientBuffersAllocateService(openthread_get_default_instance());
-				// get the service instance name string buffer from OT SRP API
-				string = otSrpClientBuffersGetServiceEntryInstanceNameString(entry, &size); // make sure "service_instance" is not bigger than "size"!
-				// copy the service instance
-				#if defined SRP_CLIENT_RNG || defined SRP_CLIENT_UNIQUE
-				memcpy(string, realinstance, sizeof(realinstance)+1);
-				#else
-				memcpy(string, service_instance, sizeof(service_instance)+1);		
-				#endif		
-				// get the service name string buffer from OT SRP API
-				string = otSrpClientBuffersGetServiceEntryServiceNameString(entry, &size);
-				// copy the service name (_ot._udp)
-				memcpy(string, service_name, sizeof(service_name)+1); // make sure "service_name" is not bigger than "size"!;
-				// configure service
-				entry->mService.mNumTxtEntries = 0;
-				entry->mService.mPort = 49154;
-				// add service
-				if (otSrpClientAddService(openthread_get_default_instance(), &entry->mService) != OT_ERROR_NONE)
-					LOG_INF("Cannot add service to SRP client");
-				else
-					LOG_INF("Adding SRP client service...");
-				// start SRP client (and set to auto-mode)
-				otSrpClientEnableAutoStartMode(openthread_get_default_instance(), NULL, NULL);
-				entry = NULL;
-			}
 			break;
 
 		case OT_DEVICE_ROLE_DISABLED:
@@ -279,95 +193,164 @@ static void on_pump_timer_expiry(struct k_timer *timer_id)
 
 }
 
-static void on_adc_timer_expiry(struct k_timer *timer_id)
+/* Runs on the sampling work queue, after the cache is updated */
+static void on_sample_cached(const struct sample_set *set)
 {
-	ARG_UNUSED(timer_id);
+	sample_history_add(set);
+#ifdef CONFIG_COAP_SERVER_SAMPLE_LOG
+	sample_log_add(set);
+#endif
+	coap_notify_temperature();
+}
+
+static struct sampling_listener coap_sampling_listener = {
+	.on_sample = on_sample_cached,
+};
 
+/* Runs on the sampling work queue */
+static int on_adc_sample(struct sample_set *set)
+{
 	int err;
-	int32_t val_mv;
 
-	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+	/* one conversion burst for every channel */
+	err = adc_scan_read(set->val_mv);
+	if (err < 0) {
+		return err;
+	}
 
+	set->temperature = calibration_temperature(set->val_mv[TEMPERATURE_ADC_CHANNEL]);
+	temperature = set->temperature;
 
-		(void)adc_sequence_init_dt(&adc_channels[i], &sequence);
+	return 0;
+}
 
-		err = adc_read(adc_channels[i].dev, &sequence);
-		if (err < 0) {
-			LOG_ERR("Could not read (%d)\n", err);
-			continue;
-		}
+#ifdef CONFIG_USB_DEVICE_STACK
+/* Runs on the system work queue, in parallel with the rest of the startup */
+static void usb_work_handler(struct k_work *work)
+{
+	int ret;
 
-		/* conversion to mV may not be supported, skip if not */
-		val_mv = buf;
-		err = adc_raw_to_millivolts_dt(&adc_channels[i],
-							&val_mv);
-		if (err < 0) {
-			LOG_ERR(" (value in mV not available)\n");
-		}
+	ARG_UNUSED(work);
+
+	ret = usb_enable(NULL);
+	if (ret != 0) {
+		LOG_ERR("Failed to enable USB, err code: %d", ret);
+		boot_phase_fail(BOOT_PHASE_USB, ret);
+		return;
 	}
 
-	temperature = (int16_t)val_mv;
+	boot_phase_mark(BOOT_PHASE_USB);
 }
 
-int main(void)
+static K_WORK_DEFINE(usb_work, usb_work_handler);
+#endif
+
+/* ADC, history and log behind the sampling work queue. Without it the node
+ * keeps serving everything but the samples (5.03).
+ */
+static int sampling_setup(void)
 {
 	int ret;
 
-	/* enable USB */
-	ret = usb_enable(NULL);
-	if (ret != 0) {
-		LOG_ERR("Failed to enable USB");
-		return 0;
+	/* Configure every channel and the multi-channel scan sequence. */
+	ret = adc_scan_init();
+	if (ret) {
+		LOG_ERR("Could not initialize ADC scan, err code: %d", ret);
+		return ret;
 	}
 
-	/* Configure channels individually prior to sampling. */
-	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
-		if (!device_is_ready(adc_channels[i].dev)) {
-			LOG_ERR("ADC controller device not ready\n");
-			return;
-		}
-		ret = adc_channel_setup_dt(&adc_channels[i]);
-		if (ret < 0) {
-			LOG_ERR("Could not setup channel #%d (%d)\n", i, ret);
-			return;
-		}
+	ret = sampling_init(on_adc_sample);
+	if (ret) {
+		LOG_ERR("Could not initialize sampling, err code: %d", ret);
+		return ret;
 	}
 
-	/* generate a SRP client name to be advertised (mode defined in ot_srp_config.h macros) */
-	srp_client_generate_name();
-
-	LOG_INF("Start CoAP-server sample");
-	ret = ot_coap_init(&on_light_request, &on_temperature_request, &on_info_request);
+	sample_history_init();
+#ifdef CONFIG_COAP_SERVER_SAMPLE_LOG
+	/* the node keeps serving live values if the log cannot be mounted */
+	(void)sample_log_init();
+#endif
+	sampling_listener_register(&coap_sampling_listener);
+#ifdef CONFIG_COAP_SERVER_TELEMETRY
+	ret = telemetry_init(openthread_get_default_instance());
 	if (ret) {
-		LOG_ERR("Could not initialize OpenThread CoAP");
-		goto end;
+		LOG_ERR("Could not initialize telemetry, err code: %d", ret);
 	}
+#endif
+
+	/* The temperature is sampled in the background, CoAP requests are served from the cache */
+	sampling_start();
+
+	return 0;
+}
 
+int main(void)
+{
+	int ret;
+
+	boot_phase_mark(BOOT_PHASE_MAIN);
+
+#ifdef CONFIG_USB_DEVICE_STACK
+	/* enumeration takes a while, it does not hold up the network */
+	k_work_submit(&usb_work);
+#endif
+
+	/* LEDs, buttons and the pump are needed by the first requests, and quick */
 	ret = dk_leds_init();
-	if (ret) {
-		LOG_ERR("Could not initialize leds, err code: %d", ret);
-		goto end;
+	if (ret == 0) {
+		ret = dk_buttons_init(on_button_changed);
 	}
-
-	ret = dk_buttons_init(on_button_changed);
 	if (ret) {
-		LOG_ERR("Cannot init buttons (error: %d)", ret);
-		goto end;
+		LOG_ERR("Could not initialize leds and buttons, err code: %d", ret);
+		boot_phase_fail(BOOT_PHASE_PERIPHERALS, ret);
+	} else {
+		boot_phase_mark(BOOT_PHASE_PERIPHERALS);
 	}
 
 	/* Timer */
 	k_timer_init(&pump_timer, on_pump_timer_expiry, NULL);
-	k_timer_init(&adc_timer, on_adc_timer_expiry, NULL);
-	/* 
-		If we want to get the temperature value periodically, start the timer.
-		Otherwise, the ADC will be check only upon a tempereature GET request 
-		from coap server. 
-	*/
-	//k_timer_start(&adc_timer, K_SECONDS(ADC_TIMER_PERIOD), K_SECONDS(ADC_TIMER_PERIOD));
+	pump_schedule_init(on_schedule_run);
+
+	/* the SRP names are kept in settings, registered again on every attach */
+	ret = ot_srp_init(openthread_get_default_instance());
+	if (ret) {
+		/* still reachable by address */
+		LOG_ERR("Could not initialize SRP registration, err code: %d", ret);
+	}
 
+	LOG_INF("Start CoAP-server sample");
+	ret = ot_coap_init(&on_light_request, &on_temperature_request, &on_info_request,
+			   &on_sensors_request);
+	if (ret) {
+		/* still attaches, so that the node can be reached from the shell and pinged */
+		LOG_ERR("Could not initialize OpenThread CoAP");
+		boot_phase_fail(BOOT_PHASE_COAP, ret);
+	} else {
+		boot_phase_mark(BOOT_PHASE_COAP);
+	}
+
+#ifdef CONFIG_COAP_SERVER_SLEEPY
+	/* the link mode has to be set before the node attaches */
+	ret = sleepy_init(openthread_get_default_instance());
+	if (ret) {
+		LOG_ERR("Could not configure the sleepy mode, err code: %d", ret);
+	}
+#endif
+
+	/* before the state callback, which refreshes the snapshot on role changes */
+	mesh_diag_init(openthread_get_default_instance());
+
+	/* Attach as early as possible, it runs on the OpenThread thread from here */
 	openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
 	openthread_start(openthread_get_default_context());
+	boot_phase_mark(BOOT_PHASE_THREAD);
+
+	ret = sampling_setup();
+	if (ret) {
+		boot_phase_fail(BOOT_PHASE_SAMPLING, ret);
+	} else {
+		boot_phase_mark(BOOT_PHASE_SAMPLING);
+	}
 
-end:
 	return 0;
 }
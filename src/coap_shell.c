@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/shell/shell.h>
+
+/* Root of the "coap" shell command, modules add their subcommands with
+ * SHELL_SUBCMD_ADD((coap), ...).
+ */
+SHELL_SUBCMD_SET_CREATE(sub_coap, (coap));
+
+SHELL_CMD_REGISTER(coap, &sub_coap, "CoAP server commands", NULL);
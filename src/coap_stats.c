@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/message.h>
+
+#include "boot_phase.h"
+#include "coap_stats.h"
+#include "senml_cbor.h"
+#include "sleepy.h"
+
+static const char *const counter_names[] = {
+	[COAP_STATS_REQUESTS] = "requests",
+	[COAP_STATS_UNKNOWN_RESOURCE] = "unknown_resource",
+	[COAP_STATS_TOO_LARGE] = "too_large",
+	[COAP_STATS_BAD_TYPE] = "bad_type",
+	[COAP_STATS_BAD_METHOD] = "bad_method",
+	[COAP_STATS_NOT_ACCEPTABLE] = "not_acceptable",
+	[COAP_STATS_SERIALIZE_ERRORS] = "serialize_errors",
+	[COAP_STATS_RATE_LIMITED] = "rate_limited",
+	[COAP_STATS_LOW_BUFFERS] = "low_buffers",
+	[COAP_STATS_QUEUE_FULL] = "queue_full",
+	[COAP_STATS_DEADLINE_MISSED] = "deadline_missed",
+	[COAP_STATS_SEPARATE_RESPONSES] = "separate",
+	[COAP_STATS_DEDUP_HITS] = "dedup_hits",
+	[COAP_STATS_DEDUP_MISSES] = "dedup_misses",
+	[COAP_STATS_GROUP_COMMANDS] = "group_commands",
+	[COAP_STATS_SUPPRESSED] = "suppressed",
+	[COAP_STATS_UNAUTHORIZED] = "unauthorized",
+	[COAP_STATS_SECURE_SESSIONS] = "secure_sessions",
+	[COAP_STATS_TELEMETRY_UPLOADS] = "telemetry_uploads",
+	[COAP_STATS_TELEMETRY_FAILURES] = "telemetry_failures",
+	[COAP_STATS_TELEMETRY_DROPPED] = "telemetry_dropped",
+	[COAP_STATS_SRP_REGISTRATIONS] = "srp_registrations",
+	[COAP_STATS_SRP_DUPLICATES] = "srp_duplicates",
+	[COAP_STATS_NO_BUFS] = "no_bufs",
+	[COAP_STATS_SEND_ERRORS] = "send_errors",
+	[COAP_STATS_ADC_ERRORS] = "adc_errors",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(counter_names) == COAP_STATS_COUNTER_COUNT);
+/* senml_begin() counts the records in a uint8_t, coap_stats_senml() keeps one
+ * bit per histogram
+ */
+BUILD_ASSERT(COAP_STATS_RECORDS_MAX <= UINT8_MAX, "Too many records for one SenML pack");
+BUILD_ASSERT(COAP_STATS_HISTOGRAMS_MAX <= 32, "Too many histograms");
+
+static otInstance *ot;
+static atomic_t counters[COAP_STATS_COUNTER_COUNT];
+static sys_slist_t histograms = SYS_SLIST_STATIC_INIT(&histograms);
+/* histograms are updated from the OpenThread thread and the sampling work queue */
+static struct k_spinlock hist_lock;
+
+void coap_stats_histogram_register(struct coap_stats_histogram *hist, const char *name)
+{
+	__ASSERT(sys_slist_len(&histograms) < COAP_STATS_HISTOGRAMS_MAX, "Too many histograms");
+
+	memset(hist, 0, sizeof(*hist));
+	hist->name = name;
+	sys_slist_append(&histograms, &hist->node);
+}
+
+void coap_stats_record(struct coap_stats_histogram *hist, uint32_t start)
+{
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	size_t bucket = us > 0 ? MIN(31 - __builtin_clz(us), COAP_STATS_BUCKETS - 1) : 0;
+	k_spinlock_key_t key = k_spin_lock(&hist_lock);
+
+	hist->count++;
+	hist->total_us += us;
+	hist->max_us = MAX(hist->max_us, us);
+	hist->buckets[bucket]++;
+
+	k_spin_unlock(&hist_lock, key);
+}
+
+void coap_stats_inc(enum coap_stats_counter counter)
+{
+	atomic_inc(&counters[counter]);
+}
+
+void coap_stats_init(otInstance *instance)
+{
+	ot = instance;
+}
+
+void coap_stats_reset(void)
+{
+	struct coap_stats_histogram *hist;
+	k_spinlock_key_t key;
+
+	for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+		atomic_clear(&counters[i]);
+	}
+
+	key = k_spin_lock(&hist_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&histograms, hist, node) {
+		hist->count = 0;
+		hist->total_us = 0;
+		hist->max_us = 0;
+		memset(hist->buckets, 0, sizeof(hist->buckets));
+	}
+	k_spin_unlock(&hist_lock, key);
+
+	if (ot != NULL) {
+		openthread_api_mutex_lock(openthread_get_default_context());
+		otMessageResetBufferInfo(ot);
+		openthread_api_mutex_unlock(openthread_get_default_context());
+	}
+}
+
+static void buffer_info_get(otBufferInfo *info)
+{
+	memset(info, 0, sizeof(*info));
+
+	if (ot != NULL) {
+		openthread_api_mutex_lock(openthread_get_default_context());
+		otMessageGetBufferInfo(ot, info);
+		openthread_api_mutex_unlock(openthread_get_default_context());
+	}
+}
+
+/* Upper bound, in us, of the bucket holding the pct percentile */
+static uint32_t histogram_percentile(const struct coap_stats_histogram *hist, uint32_t pct)
+{
+	uint32_t rank = DIV_ROUND_UP((uint64_t)hist->count * pct, 100);
+	uint32_t seen = 0;
+
+	for (size_t i = 0; i < COAP_STATS_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			return MIN(BIT(i + 1), hist->max_us);
+		}
+	}
+
+	return hist->max_us;
+}
+
+static void senml_counter(struct senml_writer *writer, const char *name, const char *suffix,
+			  const char *unit, int64_t value)
+{
+	char full_name[32];
+
+	snprintf(full_name, sizeof(full_name), "%s%s", name, suffix);
+	senml_record(writer, unit != NULL ? 3 : 2);
+	senml_name(writer, full_name);
+	if (unit != NULL) {
+		senml_unit(writer, unit);
+	}
+	senml_value(writer, value);
+}
+
+int coap_stats_senml(uint8_t *buf, size_t size)
+{
+	struct senml_writer writer;
+	struct coap_stats_histogram *hist;
+	struct coap_stats_histogram copy;
+	otBufferInfo info;
+	size_t records = COAP_STATS_COUNTER_COUNT + 3;
+	/* histograms that had samples when the records were counted */
+	uint32_t reported = 0;
+	size_t n;
+	k_spinlock_key_t key;
+#ifdef CONFIG_COAP_SERVER_SLEEPY
+	uint32_t csl_period_ms, current_ua;
+
+	/* the latencies below belong to this period */
+	sleepy_report(&csl_period_ms, &current_ua);
+	records += 2;
+#endif
+
+	buffer_info_get(&info);
+
+	/* uptime of each startup phase reached */
+	for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+		records += boot_phase_ms(i) >= 0 ? 1 : 0;
+	}
+
+	/* count, p50, p99 and max of each histogram that has samples */
+	n = 0;
+	key = k_spin_lock(&hist_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&histograms, hist, node) {
+		if (hist->count > 0) {
+			reported |= BIT(n);
+			records += 4;
+		}
+		n++;
+	}
+	k_spin_unlock(&hist_lock, key);
+
+	senml_begin(&writer, buf, size, records);
+
+	for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+		senml_counter(&writer, counter_names[i], "", NULL, atomic_get(&counters[i]));
+	}
+
+	senml_counter(&writer, "buffers", "", NULL, info.mTotalBuffers);
+	senml_counter(&writer, "buffers", "_free", NULL, info.mFreeBuffers);
+	senml_counter(&writer, "buffers", "_max_used", NULL, info.mMaxUsedBuffers);
+#ifdef CONFIG_COAP_SERVER_SLEEPY
+	senml_counter(&writer, "csl_period", "", "ms", csl_period_ms);
+	senml_counter(&writer, "current", "", "uA", current_ua);
+#endif
+
+	for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+		if (boot_phase_ms(i) >= 0) {
+			senml_counter(&writer, "boot_", boot_phase_name(i), "ms", boot_phase_ms(i));
+		}
+	}
+
+	/* each histogram is copied so that encoding does not hold the lock; one
+	 * reset in between reports zeros rather than changing the record count
+	 */
+	n = 0;
+	SYS_SLIST_FOR_EACH_CONTAINER(&histograms, hist, node) {
+		if (!(reported & BIT(n++))) {
+			continue;
+		}
+
+		key = k_spin_lock(&hist_lock);
+		copy = *hist;
+		k_spin_unlock(&hist_lock, key);
+
+		senml_counter(&writer, copy.name, "_n", NULL, copy.count);
+		senml_counter(&writer, copy.name, "_p50", "us", histogram_percentile(&copy, 50));
+		senml_counter(&writer, copy.name, "_p99", "us", histogram_percentile(&copy, 99));
+		senml_counter(&writer, copy.name, "_max", "us", copy.max_us);
+	}
+
+	return senml_end(&writer);
+}
+
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct coap_stats_histogram *hist;
+	struct coap_stats_histogram copy;
+	otBufferInfo info;
+	k_spinlock_key_t key;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	for (size_t i = 0; i < ARRAY_SIZE(counters); i++) {
+		shell_print(sh, "%-17s %u", counter_names[i], (uint32_t)atomic_get(&counters[i]));
+	}
+
+	buffer_info_get(&info);
+	shell_print(sh, "message buffers: %u total, %u free, %u max used", info.mTotalBuffers,
+		    info.mFreeBuffers, info.mMaxUsedBuffers);
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&histograms, hist, node) {
+		/* copied so that printing does not hold the lock */
+		key = k_spin_lock(&hist_lock);
+		copy = *hist;
+		k_spin_unlock(&hist_lock, key);
+
+		if (copy.count == 0) {
+			shell_print(sh, "%s: no samples", copy.name);
+			continue;
+		}
+
+		shell_print(sh, "%s: n %u, avg %u us, p50 <%u us, p99 <%u us, max %u us", copy.name,
+			    copy.count, (uint32_t)(copy.total_us / copy.count),
+			    histogram_percentile(&copy, 50), histogram_percentile(&copy, 99),
+			    copy.max_us);
+		for (size_t i = 0; i < COAP_STATS_BUCKETS; i++) {
+			if (copy.buckets[i] > 0) {
+				shell_print(sh, "  %6u us%s %u", (uint32_t)BIT(i),
+					    i == COAP_STATS_BUCKETS - 1 ? "+" : " ", copy.buckets[i]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_stats_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	coap_stats_reset();
+	shell_print(sh, "Statistics cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_stats,
+	SHELL_CMD(reset, NULL, "Clear counters, histograms and high-water marks", cmd_stats_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((coap), stats, &sub_stats, "Request and ADC statistics", cmd_stats, 1, 0);
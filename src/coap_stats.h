@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_STATS_H__
+#define __COAP_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
+#include <openthread/instance.h>
+
+#include "boot_phase.h"
+
+/**@brief Bucket i counts durations in [2^i, 2^(i+1)) us, the last one everything above. */
+#define COAP_STATS_BUCKETS 16
+
+enum coap_stats_counter {
+	/* requests that reached a resource handler */
+	COAP_STATS_REQUESTS,
+	/* requests for a path that is not in the resource table */
+	COAP_STATS_UNKNOWN_RESOURCE,
+	/* options or payload too large to be copied out of the request */
+	COAP_STATS_TOO_LARGE,
+	/* rejected on message type, method or Accept option */
+	COAP_STATS_BAD_TYPE,
+	COAP_STATS_BAD_METHOD,
+	COAP_STATS_NOT_ACCEPTABLE,
+	COAP_STATS_SERIALIZE_ERRORS,
+	/* admission control, answered 5.03: the peer is over its rate, the
+	 * message buffer reserve is reached, every request job is in use
+	 */
+	COAP_STATS_RATE_LIMITED,
+	COAP_STATS_LOW_BUFFERS,
+	COAP_STATS_QUEUE_FULL,
+	/* waited longer than CONFIG_COAP_SERVER_REQUEST_DEADLINE, answered 5.03 */
+	COAP_STATS_DEADLINE_MISSED,
+	/* CON requests handed to the work queue, answered with a separate response */
+	COAP_STATS_SEPARATE_RESPONSES,
+	/* retransmitted CON requests answered from the deduplication cache, and new ones */
+	COAP_STATS_DEDUP_HITS,
+	COAP_STATS_DEDUP_MISSES,
+	/* light commands sent to a group, responses withheld for No-Response or multicast */
+	COAP_STATS_GROUP_COMMANDS,
+	COAP_STATS_SUPPRESSED,
+	/* plaintext PUTs refused by CONFIG_COAP_SERVER_SECURE_WRITES, DTLS sessions set up */
+	COAP_STATS_UNAUTHORIZED,
+	COAP_STATS_SECURE_SESSIONS,
+	/* telemetry batches acknowledged by the collector, failed attempts,
+	 * samples overwritten before they could be sent
+	 */
+	COAP_STATS_TELEMETRY_UPLOADS,
+	COAP_STATS_TELEMETRY_FAILURES,
+	COAP_STATS_TELEMETRY_DROPPED,
+	/* SRP registrations completed after an attach, names found taken */
+	COAP_STATS_SRP_REGISTRATIONS,
+	COAP_STATS_SRP_DUPLICATES,
+	/* otCoapNewMessage() out of message buffers */
+	COAP_STATS_NO_BUFS,
+	COAP_STATS_SEND_ERRORS,
+	COAP_STATS_ADC_ERRORS,
+	COAP_STATS_COUNTER_COUNT,
+};
+
+/**@brief Most histograms coap_stats_histogram_register() takes. */
+#define COAP_STATS_HISTOGRAMS_MAX 16
+
+/**@brief Most records of coap_stats_senml(): the counters, 3 for the message
+ * buffers, the CSL period and current, one per startup phase and 4 per histogram.
+ */
+#define COAP_STATS_RECORDS_MAX                                                                     \
+	(COAP_STATS_COUNTER_COUNT + 3 + 2 + BOOT_PHASE_COUNT + 4 * COAP_STATS_HISTOGRAMS_MAX)
+
+/**@brief Largest record: map head, then name of up to 31 characters, unit of
+ * up to 2 and 32-bit value, each with its label.
+ */
+#define COAP_STATS_RECORD_MAX_SIZE (1 + (1 + 2 + 31) + (1 + 1 + 2) + (1 + 5))
+
+/**@brief Room for the largest coap_stats_senml() pack, array head included. */
+#define COAP_STATS_SENML_MAX_SIZE (2 + COAP_STATS_RECORDS_MAX * COAP_STATS_RECORD_MAX_SIZE)
+
+/**@brief Latency histogram of one code path. */
+struct coap_stats_histogram {
+	sys_snode_t node;
+	const char *name;
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t total_us;
+	uint32_t buckets[COAP_STATS_BUCKETS];
+};
+
+/**@brief Add a histogram to the report. Call once, before it is used, for
+ * at most COAP_STATS_HISTOGRAMS_MAX histograms.
+ */
+void coap_stats_histogram_register(struct coap_stats_histogram *hist, const char *name);
+
+/**@brief Record the time elapsed since start, a k_cycle_get_32() value. */
+void coap_stats_record(struct coap_stats_histogram *hist, uint32_t start);
+
+void coap_stats_inc(enum coap_stats_counter counter);
+
+/**@brief Remember the OpenThread instance whose message buffers are reported. */
+void coap_stats_init(otInstance *ot);
+
+/**@brief Clear every counter, histogram and the buffer high-water mark. */
+void coap_stats_reset(void);
+
+/**@brief Write the statistics into buf as a SenML pack: the counters, the
+ * message buffers and the count, p50, p99 and maximum of each histogram.
+ *
+ * @return Length of the pack, -ENOMEM if it does not fit. It always fits in
+ * COAP_STATS_SENML_MAX_SIZE bytes.
+ */
+int coap_stats_senml(uint8_t *buf, size_t size);
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "coap_trace.h"
+
+#define TRACE_ENTRIES CONFIG_COAP_SERVER_TRACE_ENTRIES
+
+BUILD_ASSERT(IS_POWER_OF_TWO(TRACE_ENTRIES), "trace entries must be a power of two");
+BUILD_ASSERT(COAP_TRACE_MOD_COUNT <= 8 * sizeof(atomic_val_t));
+
+/* seq is the reservation number + 1 of the event in the slot, 0 while it is written */
+struct trace_slot {
+	atomic_t seq;
+	struct coap_trace_event event;
+};
+
+static const char *const module_names[] = {
+	[COAP_TRACE_MOD_COAP] = "coap",
+	[COAP_TRACE_MOD_OBSERVE] = "observe",
+	[COAP_TRACE_MOD_SAMPLING] = "sampling",
+	[COAP_TRACE_MOD_SCHEDULE] = "schedule",
+	[COAP_TRACE_MOD_TELEMETRY] = "telemetry",
+	[COAP_TRACE_MOD_SRP] = "srp",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(module_names) == COAP_TRACE_MOD_COUNT);
+
+static struct trace_slot ring[TRACE_ENTRIES];
+/* number of reservations so far, a writer owns slot (head % TRACE_ENTRIES) */
+static atomic_t head;
+/* next reservation to decode, only touched by the drain */
+static uint32_t tail;
+static atomic_t module_mask = ATOMIC_INIT(CONFIG_COAP_SERVER_TRACE_MASK);
+
+void coap_trace(enum coap_trace_id id, const char *name, uint16_t arg0, int32_t arg1)
+{
+	struct trace_slot *slot;
+	uint32_t seq;
+
+	if (!(atomic_get(&module_mask) & BIT(COAP_TRACE_MODULE(id)))) {
+		return;
+	}
+
+	seq = (uint32_t)atomic_inc(&head);
+	slot = &ring[seq % TRACE_ENTRIES];
+
+	atomic_set(&slot->seq, 0);
+	slot->event.cycles = k_cycle_get_32();
+	slot->event.name = name;
+	slot->event.arg0 = arg0;
+	slot->event.arg1 = arg1;
+	slot->event.id = id;
+	atomic_set(&slot->seq, seq + 1);
+}
+
+static const char *type_str(uint8_t type)
+{
+	static const char *const types[] = {"CON", "NON", "ACK", "RST"};
+
+	return type < ARRAY_SIZE(types) ? types[type] : "?";
+}
+
+static void event_print(const struct shell *sh, const struct coap_trace_event *ev,
+			uint32_t now)
+{
+	const char *name = ev->name != NULL ? ev->name : "?";
+	uint8_t code = ev->arg0 & 0xFF;
+
+	shell_fprintf(sh, SHELL_NORMAL, "%10u us  ", k_cyc_to_us_floor32(now - ev->cycles));
+
+	switch (ev->id) {
+	case COAP_TRACE_REQUEST:
+		shell_print(sh, "request /%s %s %u.%02u mid %u", name, type_str(ev->arg0 >> 8),
+			    code >> 5, code & 0x1F, (uint16_t)ev->arg1);
+		break;
+	case COAP_TRACE_RESPONSE:
+		shell_print(sh, "response /%s %u.%02u, %d bytes", name, code >> 5, code & 0x1F,
+			    ev->arg1);
+		break;
+	case COAP_TRACE_BAD_TYPE:
+		shell_print(sh, "bad type /%s %s %u.%02u", name, type_str(ev->arg0 >> 8),
+			    code >> 5, code & 0x1F);
+		break;
+	case COAP_TRACE_SEND_FAILED:
+		shell_print(sh, "send failed /%s, error %d", name, ev->arg1);
+		break;
+	case COAP_TRACE_UNKNOWN_RESOURCE:
+		shell_print(sh, "unknown resource %s %u.%02u mid %u", type_str(ev->arg0 >> 8),
+			    code >> 5, code & 0x1F, (uint16_t)ev->arg1);
+		break;
+	case COAP_TRACE_BLOCK:
+		shell_print(sh, "block %u, %d bytes", ev->arg0, ev->arg1);
+		break;
+	case COAP_TRACE_LIGHT_PUT:
+		if (ev->arg1 != 0) {
+			shell_print(sh, "light PUT '%c', group %d", ev->arg0, ev->arg1);
+		} else {
+			shell_print(sh, "light PUT '%c'", ev->arg0);
+		}
+		break;
+	case COAP_TRACE_TEMPERATURE:
+		shell_print(sh, "temperature %s%d.%02d degC, max-age %u", ev->arg1 < 0 ? "-" : "",
+			    abs(ev->arg1) / 100, abs(ev->arg1) % 100, ev->arg0);
+		break;
+	case COAP_TRACE_SENSORS:
+		shell_print(sh, "sensors records 0x%x", ev->arg0);
+		break;
+	case COAP_TRACE_NO_SAMPLE:
+		shell_print(sh, "no sample for /%s", name);
+		break;
+	case COAP_TRACE_REJECTED:
+		shell_print(sh, "rejected /%s (%s), max-age %d", name,
+			    ev->arg0 == COAP_TRACE_REJECT_RATE ? "rate limit" :
+			    ev->arg0 == COAP_TRACE_REJECT_BUFFERS ? "low buffers" : "queue full",
+			    ev->arg1);
+		break;
+	case COAP_TRACE_DEADLINE_MISSED:
+		shell_print(sh, "deadline missed for /%s, queued %d ms", name, ev->arg1);
+		break;
+	case COAP_TRACE_SEPARATE:
+		shell_print(sh, "/%s mid %u queued, separate response follows", name,
+			    (uint16_t)ev->arg1);
+		break;
+	case COAP_TRACE_DUPLICATE:
+		shell_print(sh, "duplicate /%s mid %u, response replayed", name, (uint16_t)ev->arg1);
+		break;
+	case COAP_TRACE_SUPPRESSED:
+		shell_print(sh, "response %u.%02u suppressed", code >> 5, code & 0x1F);
+		break;
+	case COAP_TRACE_SECURE_SESSION:
+		if (ev->arg0) {
+			shell_print(sh, "CoAPS session up");
+		} else {
+			shell_print(sh, "CoAPS session closed after %d s", ev->arg1);
+		}
+		break;
+	case COAP_TRACE_OBSERVE_REGISTER:
+		shell_print(sh, "observer of /%s registered (pmin %u pmax %d)", name, ev->arg0,
+			    ev->arg1);
+		break;
+	case COAP_TRACE_OBSERVE_DEREGISTER:
+		shell_print(sh, "observer of /%s removed", name);
+		break;
+	case COAP_TRACE_OBSERVE_NOTIFY:
+		shell_print(sh, "notify /%s %s, value %d", name, ev->arg0 ? "CON" : "NON",
+			    ev->arg1);
+		break;
+	case COAP_TRACE_SAMPLE:
+		shell_print(sh, "sample, temperature %s%d.%02d degC", ev->arg1 < 0 ? "-" : "",
+			    abs(ev->arg1) / 100, abs(ev->arg1) % 100);
+		break;
+	case COAP_TRACE_SAMPLE_FAILED:
+		shell_print(sh, "sample failed (%d)", ev->arg1);
+		break;
+	case COAP_TRACE_SCHEDULE_SET:
+		shell_print(sh, "schedule set, %u entries, time of day %d", ev->arg0, ev->arg1);
+		break;
+	case COAP_TRACE_SCHEDULE_RUN:
+		shell_print(sh, "scheduled run for %d s, %u entries left", ev->arg1, ev->arg0);
+		break;
+	case COAP_TRACE_TELEMETRY_UPLOAD:
+		shell_print(sh, "telemetry batch of %u records acknowledged, %d pending", ev->arg0,
+			    ev->arg1);
+		break;
+	case COAP_TRACE_TELEMETRY_FAILED:
+		shell_print(sh, "telemetry upload failed, code %u.%02u, error %d", code >> 5,
+			    code & 0x1F, ev->arg1);
+		break;
+	case COAP_TRACE_TELEMETRY_COLLECTOR:
+		shell_print(sh, "telemetry collector found, port %d", ev->arg1);
+		break;
+	case COAP_TRACE_SRP_REGISTERED:
+		shell_print(sh, "SRP registered %d ms after attach, %u names taken before", ev->arg1,
+			    ev->arg0);
+		break;
+	case COAP_TRACE_SRP_DUPLICATE:
+		shell_print(sh, "SRP name %u taken, next one in %d ms", ev->arg0, ev->arg1);
+		break;
+	case COAP_TRACE_SRP_FAILED:
+		shell_print(sh, "SRP update failed (%d)", ev->arg1);
+		break;
+	default:
+		shell_print(sh, "event 0x%02x %s %u %d", ev->id, name, ev->arg0, ev->arg1);
+		break;
+	}
+}
+
+/* Decodes every complete event since the last drain, oldest first */
+static int cmd_trace(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t now = k_cycle_get_32();
+	uint32_t end = (uint32_t)atomic_get(&head);
+	uint32_t lost = 0;
+	uint32_t printed = 0;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	if (end - tail > TRACE_ENTRIES) {
+		lost = end - tail - TRACE_ENTRIES;
+		tail = end - TRACE_ENTRIES;
+	}
+
+	shell_print(sh, "%10s  event", "age");
+
+	for (; tail != end; tail++) {
+		struct trace_slot *slot = &ring[tail % TRACE_ENTRIES];
+		struct coap_trace_event ev;
+		uint32_t before;
+		uint32_t after;
+
+		before = (uint32_t)atomic_get(&slot->seq);
+		compiler_barrier();
+		ev = slot->event;
+		compiler_barrier();
+		after = (uint32_t)atomic_get(&slot->seq);
+
+		if (before != after || (int32_t)(before - (tail + 1)) < 0) {
+			/* still being written, the next drain picks it up */
+			break;
+		}
+		if (before != tail + 1) {
+			/* overwritten by a newer event since head was read */
+			lost++;
+			continue;
+		}
+
+		event_print(sh, &ev, now);
+		printed++;
+	}
+
+	shell_print(sh, "%u events, %u lost", printed, lost);
+
+	return 0;
+}
+
+static int module_find(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(module_names); i++) {
+		if (strcmp(name, module_names[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static void mask_print(const struct shell *sh)
+{
+	atomic_val_t mask = atomic_get(&module_mask);
+
+	for (size_t i = 0; i < ARRAY_SIZE(module_names); i++) {
+		shell_print(sh, "%-9s %s", module_names[i], (mask & BIT(i)) ? "on" : "off");
+	}
+}
+
+static int mask_update(const struct shell *sh, size_t argc, char **argv, bool enable)
+{
+	atomic_val_t bits = 0;
+
+	for (size_t i = 1; i < argc; i++) {
+		int module;
+
+		if (strcmp(argv[i], "all") == 0) {
+			bits = BIT_MASK(COAP_TRACE_MOD_COUNT);
+			continue;
+		}
+
+		module = module_find(argv[i]);
+		if (module < 0) {
+			shell_error(sh, "Unknown module %s", argv[i]);
+			return -EINVAL;
+		}
+		bits |= BIT(module);
+	}
+
+	if (enable) {
+		atomic_or(&module_mask, bits);
+	} else {
+		atomic_and(&module_mask, ~bits);
+	}
+
+	mask_print(sh);
+
+	return 0;
+}
+
+static int cmd_trace_on(const struct shell *sh, size_t argc, char **argv)
+{
+	return mask_update(sh, argc, argv, true);
+}
+
+static int cmd_trace_off(const struct shell *sh, size_t argc, char **argv)
+{
+	return mask_update(sh, argc, argv, false);
+}
+
+static int cmd_trace_modules(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	mask_print(sh);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_trace,
+	SHELL_CMD_ARG(on, NULL, "Enable modules: on <module|all>...", cmd_trace_on, 2, 8),
+	SHELL_CMD_ARG(off, NULL, "Disable modules: off <module|all>...", cmd_trace_off, 2, 8),
+	SHELL_CMD(modules, NULL, "Show which modules are traced", cmd_trace_modules),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((coap), trace, &sub_trace, "Decode and drain the trace buffer", cmd_trace, 1,
+		 0);
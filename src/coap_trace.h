@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_TRACE_H__
+#define __COAP_TRACE_H__
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/**@brief Sources of trace events, each one can be enabled at runtime. */
+enum coap_trace_module {
+	COAP_TRACE_MOD_COAP,
+	COAP_TRACE_MOD_OBSERVE,
+	COAP_TRACE_MOD_SAMPLING,
+	COAP_TRACE_MOD_SCHEDULE,
+	COAP_TRACE_MOD_TELEMETRY,
+	COAP_TRACE_MOD_SRP,
+	COAP_TRACE_MOD_COUNT,
+};
+
+/* event ids carry their module in the upper bits */
+#define COAP_TRACE_ID(module, n) (((module) << 4) | (n))
+#define COAP_TRACE_MODULE(id) ((id) >> 4)
+
+enum coap_trace_id {
+	/* name: URI path, arg0: type << 8 | code, arg1: message ID */
+	COAP_TRACE_REQUEST = COAP_TRACE_ID(COAP_TRACE_MOD_COAP, 0),
+	/* name: URI path, arg0: response code, arg1: payload length */
+	COAP_TRACE_RESPONSE,
+	/* name: URI path, arg0: type << 8 | code */
+	COAP_TRACE_BAD_TYPE,
+	/* name: URI path, arg1: otError */
+	COAP_TRACE_SEND_FAILED,
+	/* arg0: type << 8 | code, arg1: message ID */
+	COAP_TRACE_UNKNOWN_RESOURCE,
+	/* arg0: block number, arg1: block length */
+	COAP_TRACE_BLOCK,
+	/* arg0: command, arg1: group ID, 0 for unicast */
+	COAP_TRACE_LIGHT_PUT,
+	/* arg0: Max-Age, arg1: temperature in 0.01 degC */
+	COAP_TRACE_TEMPERATURE,
+	/* arg0: record selection */
+	COAP_TRACE_SENSORS,
+	/* name: URI path */
+	COAP_TRACE_NO_SAMPLE,
+	/* name: URI path, arg0: coap_trace_reject reason, arg1: Max-Age of the 5.03 */
+	COAP_TRACE_REJECTED,
+	/* name: URI path, arg1: ms spent in the queue */
+	COAP_TRACE_DEADLINE_MISSED,
+	/* name: URI path, arg1: message ID of the CON request */
+	COAP_TRACE_SEPARATE,
+	/* name: URI path, arg1: message ID of the retransmission */
+	COAP_TRACE_DUPLICATE,
+	/* arg0: response code not sent */
+	COAP_TRACE_SUPPRESSED,
+	/* arg0: connected, arg1: session length in s on disconnection */
+	COAP_TRACE_SECURE_SESSION,
+
+	/* name: URI path, arg0: pmin, arg1: pmax */
+	COAP_TRACE_OBSERVE_REGISTER = COAP_TRACE_ID(COAP_TRACE_MOD_OBSERVE, 0),
+	/* name: URI path */
+	COAP_TRACE_OBSERVE_DEREGISTER,
+	/* name: URI path, arg0: confirmable, arg1: value */
+	COAP_TRACE_OBSERVE_NOTIFY,
+
+	/* arg1: temperature in 0.01 degC */
+	COAP_TRACE_SAMPLE = COAP_TRACE_ID(COAP_TRACE_MOD_SAMPLING, 0),
+	/* arg1: error code */
+	COAP_TRACE_SAMPLE_FAILED,
+
+	/* arg0: number of entries, arg1: time of day or -1 */
+	COAP_TRACE_SCHEDULE_SET = COAP_TRACE_ID(COAP_TRACE_MOD_SCHEDULE, 0),
+	/* arg0: entries left, arg1: duration */
+	COAP_TRACE_SCHEDULE_RUN,
+
+	/* arg0: number of records, arg1: samples still pending */
+	COAP_TRACE_TELEMETRY_UPLOAD = COAP_TRACE_ID(COAP_TRACE_MOD_TELEMETRY, 0),
+	/* arg0: response code or 0, arg1: otError */
+	COAP_TRACE_TELEMETRY_FAILED,
+	/* arg1: collector port */
+	COAP_TRACE_TELEMETRY_COLLECTOR,
+
+	/* arg0: names taken before, arg1: ms since attach */
+	COAP_TRACE_SRP_REGISTERED = COAP_TRACE_ID(COAP_TRACE_MOD_SRP, 0),
+	/* arg0: names taken before, arg1: ms until the next name is tried */
+	COAP_TRACE_SRP_DUPLICATE,
+	/* arg1: otError */
+	COAP_TRACE_SRP_FAILED,
+};
+
+/**@brief Reasons of COAP_TRACE_REJECTED. */
+enum coap_trace_reject {
+	COAP_TRACE_REJECT_RATE,
+	COAP_TRACE_REJECT_BUFFERS,
+	COAP_TRACE_REJECT_QUEUE,
+};
+
+/**@brief Fixed-size binary trace record. */
+struct coap_trace_event {
+	/* k_cycle_get_32() when recorded */
+	uint32_t cycles;
+	/* static string (usually a URI path) or NULL, only dereferenced when decoding */
+	const char *name;
+	int32_t arg1;
+	uint16_t arg0;
+	uint8_t id;
+};
+
+#if defined(CONFIG_COAP_SERVER_TRACE)
+
+/**@brief Record an event if its module is enabled. Lock-free, safe from any
+ * context including ISRs. When the ring is full the oldest events are
+ * overwritten.
+ */
+void coap_trace(enum coap_trace_id id, const char *name, uint16_t arg0, int32_t arg1);
+
+#else
+
+static inline void coap_trace(enum coap_trace_id id, const char *name, uint16_t arg0,
+			      int32_t arg1)
+{
+	ARG_UNUSED(id);
+	ARG_UNUSED(name);
+	ARG_UNUSED(arg0);
+	ARG_UNUSED(arg1);
+}
+
+#endif
+
+#endif
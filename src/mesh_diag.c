@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/link.h>
+#include <openthread/platform/radio.h>
+#include <openthread/thread.h>
+
+#include "mesh_diag.h"
+#include "senml_cbor.h"
+
+static otInstance *ot;
+/* written by the work handler only, copied out under diag_lock */
+static struct mesh_diag snapshot;
+static struct k_spinlock diag_lock;
+
+/* senml_begin() counts the records of the pack in a uint8_t */
+BUILD_ASSERT(15 + 6 + CONFIG_COAP_SERVER_DIAG_NEIGHBORS * 4 <= UINT8_MAX,
+	     "Too many neighbors for one SenML pack");
+static atomic_t role_changes;
+static int64_t role_changed_at;
+
+static void diag_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(diag_work, diag_work_handler);
+
+/* Lock held */
+static void parent_read(struct mesh_diag *diag)
+{
+	otRouterInfo parent;
+
+	diag->has_parent = diag->role == OT_DEVICE_ROLE_CHILD &&
+			   otThreadGetParentInfo(ot, &parent) == OT_ERROR_NONE;
+	if (!diag->has_parent) {
+		return;
+	}
+
+	diag->parent_rloc16 = parent.mRloc16;
+	diag->parent_lq_in = parent.mLinkQualityIn;
+	diag->parent_lq_out = parent.mLinkQualityOut;
+	(void)otThreadGetParentAverageRssi(ot, &diag->parent_avg_rssi);
+	(void)otThreadGetParentLastRssi(ot, &diag->parent_last_rssi);
+	diag->parent_margin = MAX(diag->parent_avg_rssi - otPlatRadioGetReceiveSensitivity(ot), 0);
+}
+
+/* Lock held */
+static void neighbors_read(struct mesh_diag *diag)
+{
+	otNeighborInfoIterator iterator = OT_NEIGHBOR_INFO_ITERATOR_INIT;
+	otNeighborInfo info;
+
+	/* on a router the children are in the table too */
+	diag->neighbor_count = 0;
+	while (diag->neighbor_count < ARRAY_SIZE(diag->neighbors) &&
+	       otThreadGetNextNeighborInfo(ot, &iterator, &info) == OT_ERROR_NONE) {
+		diag->neighbors[diag->neighbor_count++] = (struct mesh_diag_neighbor){
+			.rloc16 = info.mRloc16,
+			.avg_rssi = info.mAverageRssi,
+			.lq_in = info.mLinkQualityIn,
+			.child = info.mIsChild,
+			.age = info.mAge,
+			.frame_error_rate = info.mFrameErrorRate,
+		};
+	}
+}
+
+/* Runs on the system work queue */
+static void diag_work_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	const otMacCounters *mac;
+	const otIpCounters *ip;
+	struct mesh_diag diag = { 0 };
+	k_spinlock_key_t key;
+
+	ARG_UNUSED(work);
+
+	openthread_api_mutex_lock(ot_context);
+
+	diag.role = otThreadGetDeviceRole(ot);
+	if (diag.role != OT_DEVICE_ROLE_DISABLED && diag.role != OT_DEVICE_ROLE_DETACHED) {
+		diag.partition_id = otThreadGetPartitionId(ot);
+		diag.rloc16 = otThreadGetRloc16(ot);
+		parent_read(&diag);
+		neighbors_read(&diag);
+	}
+
+	mac = otLinkGetCounters(ot);
+	diag.mac_tx = mac->mTxTotal;
+	diag.mac_tx_retry = mac->mTxRetry;
+	diag.mac_tx_err_cca = mac->mTxErrCca;
+	diag.mac_tx_err_abort = mac->mTxErrAbort + mac->mTxErrBusyChannel;
+	diag.mac_rx = mac->mRxTotal;
+	diag.mac_rx_err = mac->mRxErrNoFrame + mac->mRxErrUnknownNeighbor +
+			  mac->mRxErrInvalidSrcAddr + mac->mRxErrSec + mac->mRxErrFcs +
+			  mac->mRxErrOther;
+
+	ip = otThreadGetIp6Counters(ot);
+	diag.ip_tx = ip->mTxSuccess;
+	diag.ip_tx_failure = ip->mTxFailure;
+	diag.ip_rx = ip->mRxSuccess;
+	diag.ip_rx_failure = ip->mRxFailure;
+
+	openthread_api_mutex_unlock(ot_context);
+
+	diag.timestamp = k_uptime_get();
+	diag.role_changes = atomic_get(&role_changes);
+	diag.role_changed_at = role_changed_at;
+
+	key = k_spin_lock(&diag_lock);
+	snapshot = diag;
+	k_spin_unlock(&diag_lock, key);
+
+	k_work_schedule(&diag_work, K_SECONDS(CONFIG_COAP_SERVER_DIAG_PERIOD));
+}
+
+void mesh_diag_init(otInstance *instance)
+{
+	ot = instance;
+	k_work_schedule(&diag_work, K_NO_WAIT);
+}
+
+void mesh_diag_role_changed(void)
+{
+	atomic_inc(&role_changes);
+	role_changed_at = k_uptime_get();
+	k_work_reschedule(&diag_work, K_NO_WAIT);
+}
+
+void mesh_diag_get(struct mesh_diag *diag)
+{
+	k_spinlock_key_t key = k_spin_lock(&diag_lock);
+
+	*diag = snapshot;
+	k_spin_unlock(&diag_lock, key);
+}
+
+static void senml_number(struct senml_writer *writer, const char *name, const char *unit,
+			 int64_t value)
+{
+	senml_record(writer, unit != NULL ? 3 : 2);
+	senml_name(writer, name);
+	if (unit != NULL) {
+		senml_unit(writer, unit);
+	}
+	senml_value(writer, value);
+}
+
+int mesh_diag_senml(uint8_t *buf, size_t size)
+{
+	struct senml_writer writer;
+	struct mesh_diag diag;
+	char name[24];
+	size_t records;
+
+	mesh_diag_get(&diag);
+
+	/* role, age, role changes, partition, rloc16, 10 counters, the parent
+	 * and 4 per neighbor
+	 */
+	records = 15 + (diag.has_parent ? 6 : 0) + diag.neighbor_count * 4;
+	senml_begin(&writer, buf, size, records);
+
+	senml_record(&writer, 2);
+	senml_name(&writer, "role");
+	senml_string_value(&writer, otThreadDeviceRoleToString(diag.role));
+	senml_number(&writer, "age", "s", (k_uptime_get() - diag.timestamp) / MSEC_PER_SEC);
+	senml_number(&writer, "role_changes", NULL, diag.role_changes);
+	senml_number(&writer, "partition", NULL, diag.partition_id);
+	senml_number(&writer, "rloc16", NULL, diag.rloc16);
+
+	if (diag.has_parent) {
+		senml_number(&writer, "parent_rloc16", NULL, diag.parent_rloc16);
+		senml_number(&writer, "parent_rssi", "dBm", diag.parent_avg_rssi);
+		senml_number(&writer, "parent_last_rssi", "dBm", diag.parent_last_rssi);
+		senml_number(&writer, "parent_lq_in", NULL, diag.parent_lq_in);
+		senml_number(&writer, "parent_lq_out", NULL, diag.parent_lq_out);
+		senml_number(&writer, "parent_margin", "dB", diag.parent_margin);
+	}
+
+	for (size_t i = 0; i < diag.neighbor_count; i++) {
+		const struct mesh_diag_neighbor *nbr = &diag.neighbors[i];
+		const char *kind = nbr->child ? "child" : "nbr";
+
+		snprintf(name, sizeof(name), "%s/%04x/rssi", kind, nbr->rloc16);
+		senml_number(&writer, name, "dBm", nbr->avg_rssi);
+		snprintf(name, sizeof(name), "%s/%04x/lq_in", kind, nbr->rloc16);
+		senml_number(&writer, name, NULL, nbr->lq_in);
+		snprintf(name, sizeof(name), "%s/%04x/age", kind, nbr->rloc16);
+		senml_number(&writer, name, "s", nbr->age);
+		/* percent of frames lost */
+		snprintf(name, sizeof(name), "%s/%04x/fer", kind, nbr->rloc16);
+		senml_number(&writer, name, "%", nbr->frame_error_rate * 100 / 0xffff);
+	}
+
+	senml_number(&writer, "mac_tx", NULL, diag.mac_tx);
+	senml_number(&writer, "mac_tx_retry", NULL, diag.mac_tx_retry);
+	senml_number(&writer, "mac_tx_err_cca", NULL, diag.mac_tx_err_cca);
+	senml_number(&writer, "mac_tx_err_abort", NULL, diag.mac_tx_err_abort);
+	senml_number(&writer, "mac_rx", NULL, diag.mac_rx);
+	senml_number(&writer, "mac_rx_err", NULL, diag.mac_rx_err);
+	senml_number(&writer, "ip_tx", NULL, diag.ip_tx);
+	senml_number(&writer, "ip_tx_failure", NULL, diag.ip_tx_failure);
+	senml_number(&writer, "ip_rx", NULL, diag.ip_rx);
+	senml_number(&writer, "ip_rx_failure", NULL, diag.ip_rx_failure);
+
+	return senml_end(&writer);
+}
+
+static int cmd_diag(const struct shell *sh, size_t argc, char **argv)
+{
+	struct mesh_diag diag;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	mesh_diag_get(&diag);
+
+	shell_print(sh, "%s, rloc16 0x%04x, partition 0x%08x, snapshot %lld ms old",
+		    otThreadDeviceRoleToString(diag.role), diag.rloc16, diag.partition_id,
+		    k_uptime_get() - diag.timestamp);
+	shell_print(sh, "%u role changes, last %lld s ago", diag.role_changes,
+		    (k_uptime_get() - diag.role_changed_at) / MSEC_PER_SEC);
+	if (diag.has_parent) {
+		shell_print(sh, "parent 0x%04x: rssi %d dBm (last %d), lq in %u out %u, margin %d dB",
+			    diag.parent_rloc16, diag.parent_avg_rssi, diag.parent_last_rssi,
+			    diag.parent_lq_in, diag.parent_lq_out, diag.parent_margin);
+	}
+	for (size_t i = 0; i < diag.neighbor_count; i++) {
+		const struct mesh_diag_neighbor *nbr = &diag.neighbors[i];
+
+		shell_print(sh, "%-5s 0x%04x: rssi %d dBm, lq in %u, age %u s, fer %u%%",
+			    nbr->child ? "child" : "nbr", nbr->rloc16, nbr->avg_rssi, nbr->lq_in,
+			    nbr->age, nbr->frame_error_rate * 100 / 0xffff);
+	}
+	shell_print(sh, "mac tx %u (retry %u, cca %u, abort %u), rx %u (err %u)", diag.mac_tx,
+		    diag.mac_tx_retry, diag.mac_tx_err_cca, diag.mac_tx_err_abort, diag.mac_rx,
+		    diag.mac_rx_err);
+	shell_print(sh, "ip6 tx %u (failed %u), rx %u (failed %u)", diag.ip_tx, diag.ip_tx_failure,
+		    diag.ip_rx, diag.ip_rx_failure);
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((coap), diag, NULL, "Mesh link quality and topology snapshot", cmd_diag, 1, 0);
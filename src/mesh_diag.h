@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __MESH_DIAG_H__
+#define __MESH_DIAG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <openthread/instance.h>
+#include <openthread/thread.h>
+
+/**@brief One entry of the neighbor table (children included). */
+struct mesh_diag_neighbor {
+	uint16_t rloc16;
+	int8_t avg_rssi;
+	/* link quality 0-3 */
+	uint8_t lq_in;
+	bool child;
+	/* s since last heard */
+	uint32_t age;
+	/* 0xffff = 100% */
+	uint16_t frame_error_rate;
+};
+
+/**@brief Mesh state copied out of OpenThread, cheap to read from any thread. */
+struct mesh_diag {
+	/* uptime (ms) at which the snapshot was taken */
+	int64_t timestamp;
+	otDeviceRole role;
+	/* role changes since boot, and uptime (ms) of the last one */
+	uint32_t role_changes;
+	int64_t role_changed_at;
+	uint32_t partition_id;
+	uint16_t rloc16;
+	/* parent link, valid for a child */
+	bool has_parent;
+	uint16_t parent_rloc16;
+	int8_t parent_avg_rssi;
+	int8_t parent_last_rssi;
+	uint8_t parent_lq_in;
+	uint8_t parent_lq_out;
+	/* dB above the receive sensitivity */
+	int8_t parent_margin;
+	uint8_t neighbor_count;
+	struct mesh_diag_neighbor neighbors[CONFIG_COAP_SERVER_DIAG_NEIGHBORS];
+	/* MAC counters */
+	uint32_t mac_tx;
+	uint32_t mac_tx_retry;
+	uint32_t mac_tx_err_cca;
+	uint32_t mac_tx_err_abort;
+	uint32_t mac_rx;
+	uint32_t mac_rx_err;
+	/* IPv6 counters */
+	uint32_t ip_tx;
+	uint32_t ip_tx_failure;
+	uint32_t ip_rx;
+	uint32_t ip_rx_failure;
+};
+
+/**@brief Take a snapshot every CONFIG_COAP_SERVER_DIAG_PERIOD seconds. */
+void mesh_diag_init(otInstance *ot);
+
+/**@brief Count a role change and take a snapshot right away, on the system
+ * work queue. Call from the OpenThread state change callback.
+ */
+void mesh_diag_role_changed(void);
+
+/**@brief Copy the last snapshot. */
+void mesh_diag_get(struct mesh_diag *diag);
+
+/**@brief The last snapshot as a SenML-CBOR pack.
+ *
+ * @return Length written, -ENOMEM if it does not fit.
+ */
+int mesh_diag_senml(uint8_t *buf, size_t size);
+
+#endif
@@ -4,16 +4,33 @@
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
 
+#include <stdarg.h>
+#include <stdlib.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/net_pkt.h>
 #include <zephyr/net/net_l2.h>
 #include <zephyr/net/openthread.h>
+#include <zephyr/random/random.h>
+#include <zephyr/sys/byteorder.h>
 #include <openthread/coap.h>
+#include <openthread/coap_secure.h>
 #include <openthread/ip6.h>
 #include <openthread/message.h>
 #include <openthread/thread.h>
 
+#include "boot_phase.h"
+#include "coap_group.h"
+#include "coap_observe.h"
+#include "coap_request.h"
+#include "coap_stats.h"
+#include "coap_trace.h"
+#include "mesh_diag.h"
 #include "ot_coap_utils.h"
+#include "pump_schedule.h"
+#include "sample_history.h"
+#include "sleepy.h"
+#include "sample_log.h"
+#include "senml_cbor.h"
 
 LOG_MODULE_REGISTER(ot_coap_utils, CONFIG_OT_COAP_UTILS_LOG_LEVEL);
 
@@ -23,6 +40,7 @@ struct server_context {
 	light_request_callback_t on_light_request;
 	temperature_request_callback_t on_temperature_request;
 	info_request_callback_t on_info_request;
+	sensors_request_callback_t on_sensors_request;
 };
 
 static struct server_context srv_context = {
@@ -32,15 +50,132 @@ static struct server_context srv_context = {
 	.on_temperature_request = NULL,
 };
 
-struct fw_version {
-	// FW version
-	const char * fw_version_buf;
-	uint8_t fw_version_size;
+/* Payload formats. Clients that send no Accept option get the legacy raw one. */
+#define FORMAT_RAW OT_COAP_OPTION_CONTENT_FORMAT_OCTET_STREAM
+#define FORMAT_SENML OT_COAP_OPTION_CONTENT_FORMAT_SENML_CBOR
+#define FORMAT_LINK OT_COAP_OPTION_CONTENT_FORMAT_LINK_FORMAT
+
+/* Formats served by a resource, as BIT() of their index in content_formats[].
+ * The first one is the default.
+ */
+#define FORMATS_RAW BIT(0)
+#define FORMATS_SENML BIT(1)
+#define FORMATS_LINK BIT(2)
+
+static const uint16_t content_formats[] = { FORMAT_RAW, FORMAT_SENML, FORMAT_LINK };
+
+/* Block-wise (RFC 7959) responses*/
+#define BLOCK_MAX_SIZE (1 << (CONFIG_COAP_SERVER_HISTORY_BLOCK_SZX + 4))
+
+/* Largest response payload, built in the request job */
+#define PAYLOAD_MAX_SIZE MAX(BLOCK_MAX_SIZE, 128)
+
+/* Max-Age of a 5.03 response when the request queue is full or a request missed its deadline */
+#define BUSY_MAX_AGE 1
+
+/* Token bucket contents are counted in thousandths of a request */
+#define RATE_TOKEN 1000
+
+/* Max-Age of a reply that carries no Max-Age option */
+#define MAX_AGE_NONE UINT32_MAX
+
+/* Room for every representation of the static resources */
+#define STATIC_PAYLOADS_SIZE 512
+
+/* Room for the /stats pack, served block-wise */
+#define STATS_SNAPSHOT_SIZE COAP_STATS_SENML_MAX_SIZE
+
+/* Room for the /diag pack with a full neighbor table, served block-wise */
+#define DIAG_SNAPSHOT_SIZE (256 + CONFIG_COAP_SERVER_DIAG_NEIGHBORS * 128)
+
+/* RFC 7252 EXCHANGE_LIFETIME with the default transmission parameters */
+#define EXCHANGE_LIFETIME_MS (247 * MSEC_PER_SEC)
+
+/* Largest response payload kept for replay to a retransmitted request */
+#define DEDUP_PAYLOAD_MAX_SIZE 32
+
+/**@brief Options and code of a response, filled in by the serializer of the resource. */
+struct coap_reply {
+	otCoapCode code;
+	/* ETag option, of a static representation or of the stream served block-wise */
+	bool has_etag;
+	uint32_t etag;
+	/* negotiated from the Accept option before the serializer runs */
+	uint16_t format;
+	/* in seconds, MAX_AGE_NONE for none */
+	uint32_t max_age;
+	/* resource the sender may observe, with the value carried by the response */
+	const struct coap_observable *observable;
+	int32_t observe_value;
+	/* Block2 option, and the Size2 option of the first block */
+	bool block2;
+	bool block_more;
+	otCoapBlockSzx block_szx;
+	uint32_t block_num;
+	uint32_t size2;
+};
+
+/**@brief Type definition of the function that handles a request and writes
+ * the response payload into buf.
+ *
+ * @return Length of the payload, or a negative error code for a 5.00 response.
+ */
+typedef int (*coap_serialize_t)(const struct coap_request *request, struct coap_reply *reply,
+				uint8_t *buf, size_t size);
+
+/**@brief Representation of a static resource, serialized once at init. */
+struct coap_static_payload {
+	const uint8_t *data;
+	uint16_t len;
+	uint32_t etag;
+};
+
+/**@brief Entry of the resource table. */
+struct coap_resource {
+	otCoapResource resource;
+	/* BIT() of the accepted request codes and message types */
+	uint8_t methods;
+	uint8_t types;
+	/* FORMATS_* mask */
+	uint8_t formats;
+	/* listed with the obs attribute in /.well-known/core */
+	bool observable;
+	/* replay the response to retransmitted CON requests that change state */
+	bool dedup;
+	/* the serializer may block on flash or the ADC: run on the work queue, a CON
+	 * request gets a separate response
+	 */
+	bool slow;
+	coap_serialize_t serialize;
+	/* one per content format for resources that never change, NULL otherwise */
+	struct coap_static_payload *payloads;
+	/* time spent in the request handler */
+	struct coap_stats_histogram latency;
+};
+
+static int light_payload_serialize(int32_t value, uint16_t format, uint8_t *buf, size_t size);
+static int temperature_payload_serialize(int32_t value, uint16_t format, uint8_t *buf,
+					 size_t size);
+static int light_observe_read(int32_t *value);
+static int temperature_observe_read(int32_t *value);
+
+static const struct coap_observable light_observable = {
+	.uri = LIGHT_URI_PATH,
+	.read = light_observe_read,
+	.serialize = light_payload_serialize,
+};
+
+static const struct coap_observable temperature_observable = {
+	.uri = TEMPERATURE_URI_PATH,
+	.scale = 100,
+	.read = temperature_observe_read,
+	.serialize = temperature_payload_serialize,
 };
 
 void coap_activate_pump(void)
 {
 	srv_context.pump_active = true;
+	coap_observe_notify(&light_observable);
 }
 
 bool coap_is_pump_active(void)
@@ -51,342 +186,1594 @@ bool coap_is_pump_active(void)
 void coap_diactivate_pump(void)
 {
 	srv_context.pump_active = false;
+	coap_observe_notify(&light_observable);
 }
 
-/**@brief Definition of CoAP resources for light. */
-static otCoapResource light_resource = {
-	.mUriPath = LIGHT_URI_PATH,
-	.mHandler = NULL,
-	.mContext = NULL,
-	.mNext = NULL,
-};
+void coap_notify_temperature(void)
+{
+	coap_observe_notify(&temperature_observable);
+}
 
-/**@brief Definition of CoAP resources for temperature. */
-static otCoapResource temperature_resource = {
-	.mUriPath = TEMPERATURE_URI_PATH,
-	.mHandler = NULL,
-	.mContext = NULL,
-	.mNext = NULL,
-};
-/* Information resource callbacks*/
-static otError info_response_send(otMessage *request_message, const otMessageInfo *message_info)
+/* Observe callbacks */
+static int light_observe_read(int32_t *value)
+{
+	*value = coap_is_pump_active();
+	return 0;
+}
+
+static int temperature_observe_read(int32_t *value)
+{
+	uint32_t max_age;
+
+	return srv_context.on_temperature_request(false, value, &max_age);
+}
+
+/* Payload serializers: raw is one byte (or the version string), SenML is a
+ * single-record pack.
+ */
+static int light_payload_serialize(int32_t value, uint16_t format, uint8_t *buf, size_t size)
+{
+	struct senml_writer writer;
+
+	if (format == FORMAT_RAW) {
+		buf[0] = (uint8_t)value;
+		return 1;
+	}
+
+	senml_begin(&writer, buf, size, 1);
+	senml_record(&writer, 2);
+	senml_name(&writer, LIGHT_URI_PATH);
+	senml_bool_value(&writer, value != 0);
+
+	return senml_end(&writer);
+}
+
+static int temperature_payload_serialize(int32_t value, uint16_t format, uint8_t *buf,
+					 size_t size)
+{
+	struct senml_writer writer;
+
+	if (format == FORMAT_RAW) {
+		// legacy clients get whole degrees
+		buf[0] = (int8_t)CLAMP(DIV_ROUND_CLOSEST(value, 100), INT8_MIN, INT8_MAX);
+		return 1;
+	}
+
+	senml_begin(&writer, buf, size, 1);
+	senml_record(&writer, 3);
+	senml_name(&writer, TEMPERATURE_URI_PATH);
+	senml_unit(&writer, "Cel");
+	senml_decimal_value(&writer, value, -2);
+
+	return senml_end(&writer);
+}
+
+static int info_payload_serialize(const struct fw_version *fw, uint16_t format, uint8_t *buf,
+				  size_t size)
+{
+	struct senml_writer writer;
+	size_t len;
+
+	if (format == FORMAT_RAW) {
+		// the version string, without its terminating NUL
+		len = strlen(fw->fw_version_buf);
+		if (len > size) {
+			return -ENOMEM;
+		}
+		memcpy(buf, fw->fw_version_buf, len);
+		return len;
+	}
+
+	senml_begin(&writer, buf, size, 1);
+	senml_record(&writer, 2);
+	senml_name(&writer, INFO_URI_PATH);
+	senml_string_value(&writer, fw->fw_version_buf);
+
+	return senml_end(&writer);
+}
+
+/* Returns the index in content_formats[] of the format asked for with the
+ * Accept option, -ENOTSUP if the resource does not serve it
+ */
+static int coap_get_accept(const struct coap_request *request, uint8_t formats)
+{
+	if (!request->has_accept) {
+		return __builtin_ctz(formats);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(content_formats); i++) {
+		if (request->accept == content_formats[i] && (formats & BIT(i))) {
+			return i;
+		}
+	}
+
+	return -ENOTSUP;
+}
+
+/* True if one of the ETag options of the request is etag */
+static bool coap_etag_match(const struct coap_request *request, uint32_t etag)
+{
+	for (size_t i = 0; i < request->etag_count; i++) {
+		if (request->etags[i] == etag) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool coap_has_uri_query(const struct coap_request *request, const char *key)
+{
+	return coap_request_query(request, key, NULL, 0);
+}
+
+/* True if the client does not want a response with this code: the RFC 7967
+ * No-Response option of a NON request, or by default an error response to a
+ * multicast request, which would only flood the network (RFC 7252 section 8.1).
+ * Empty ACKs are always sent.
+ */
+static bool coap_response_suppressed(const struct coap_request *request, otCoapCode code)
+{
+	uint8_t class = code >> 5;
+
+	if (class == 0 || request->type != OT_COAP_TYPE_NON_CONFIRMABLE) {
+		return false;
+	}
+
+	if (request->has_no_response) {
+		// one bit per response class, 2.xx is BIT(1)
+		return request->no_response & BIT(class - 1);
+	}
+
+	return request->multicast && class >= 4;
+}
+
+/**@brief Builds and sends a response in one pass: piggybacked on the ACK of a
+ * CON request, a NON message with the request token otherwise.
+ *
+ * The separate response of a CON request comes without an empty ACK first:
+ * OpenThread can only build an ACK from the request, token included, which
+ * RFC 7252 section 4.1 forbids for an Empty message. The response carries the
+ * request token, and if it is lost the client retransmits the request.
+ *
+ * @param message the request message during the OpenThread callback, NULL afterwards.
+ */
+static otError coap_response_send(const struct coap_request *request, const otMessage *message,
+				  const struct coap_reply *reply, const uint8_t *payload, size_t len)
 {
 	otError error = OT_ERROR_NO_BUFS;
 	otMessage *response;
-	const void *payload;
-	uint16_t payload_size;
-	struct fw_version fw;
 
-	fw = srv_context.on_info_request(); // get temperature from coap_server.c
+	if (coap_response_suppressed(request, reply->code)) {
+		coap_stats_inc(COAP_STATS_SUPPRESSED);
+		coap_trace(COAP_TRACE_SUPPRESSED, NULL, reply->code, 0);
+		return OT_ERROR_NONE;
+	}
 
 	response = otCoapNewMessage(srv_context.ot, NULL);
 	if (response == NULL) {
 		goto end;
 	}
 
-	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-			  OT_COAP_CODE_CONTENT);
-
-	error = otCoapMessageSetToken(
-		response, otCoapMessageGetToken(request_message),
-		otCoapMessageGetTokenLength(request_message));
+	if (request->type == OT_COAP_TYPE_CONFIRMABLE && message != NULL) {
+		error = otCoapMessageInitResponse(response, message, OT_COAP_TYPE_ACKNOWLEDGMENT,
+						  reply->code);
+	} else {
+		otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, reply->code);
+		error = otCoapMessageSetToken(response, request->token, request->token_len);
+	}
 	if (error != OT_ERROR_NONE) {
 		goto end;
 	}
 
-	error = otCoapMessageSetPayloadMarker(response);
-	if (error != OT_ERROR_NONE) {
-		goto end;
+	// options in ascending number: ETag, Observe, Content-Format, Max-Age, Block2, Size2
+	if (reply->has_etag) {
+		uint8_t etag[sizeof(reply->etag)];
+
+		sys_put_be32(reply->etag, etag);
+		error = otCoapMessageAppendOption(response, OT_COAP_OPTION_E_TAG, sizeof(etag), etag);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
 	}
 
+	// notifications go out in plaintext, CoAPS clients are not registered
+	if (reply->observable != NULL && reply->code == OT_COAP_CODE_CONTENT && !request->secure) {
+		error = coap_observe_request(reply->observable, request, response,
+					     reply->observe_value, reply->format);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
 
-	payload = &fw.fw_version_buf;
-	payload_size = sizeof(fw.fw_version_size);
+	// legacy raw responses keep carrying no Content-Format option
+	if (len > 0 && (reply->format != FORMAT_RAW || request->has_accept)) {
+		error = otCoapMessageAppendContentFormatOption(response, reply->format);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
 
-	error = otMessageAppend(response, payload, payload_size);
-	if (error != OT_ERROR_NONE) {
-		goto end;
+	if (reply->max_age != MAX_AGE_NONE) {
+		error = otCoapMessageAppendMaxAgeOption(response, reply->max_age);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (reply->block2) {
+		error = otCoapMessageAppendBlock2Option(response, reply->block_num, reply->block_more,
+							reply->block_szx);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (reply->size2 > 0) {
+		error = otCoapMessageAppendUintOption(response, OT_COAP_OPTION_SIZE2, reply->size2);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
 	}
 
-	error = otCoapSendResponse(srv_context.ot, response, message_info);
+	if (len > 0) {
+		error = otCoapMessageSetPayloadMarker(response);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
 
-	LOG_INF("Firmware version is: %s", fw.fw_version_buf);
+		error = otMessageAppend(response, payload, len);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+#ifdef CONFIG_COAP_SERVER_SECURE
+	if (request->secure) {
+		error = otCoapSecureSendResponse(srv_context.ot, response, &request->message_info);
+		goto end;
+	}
+#endif
+	error = otCoapSendResponse(srv_context.ot, response, &request->message_info);
 
 end:
 	if (error != OT_ERROR_NONE && response != NULL) {
 		otMessageFree(response);
 	}
 
+	if (error != OT_ERROR_NONE) {
+		coap_stats_inc(response == NULL ? COAP_STATS_NO_BUFS : COAP_STATS_SEND_ERRORS);
+	} else if (reply->code >> 5 == 2) {
+		boot_phase_mark(BOOT_PHASE_FIRST_RESPONSE);
+	}
+
 	return error;
 }
-static void info_request_handler(void *context, otMessage *message, const otMessageInfo *message_info)
+
+/* Sends a response with the given code and no payload */
+static otError coap_error_response_send(const struct coap_request *request,
+					const otMessage *message, otCoapCode code)
 {
-	otError error;
-	otMessageInfo msg_info;
+	const struct coap_reply reply = {
+		.code = code,
+		.max_age = MAX_AGE_NONE,
+	};
 
-	ARG_UNUSED(context);
+	return coap_response_send(request, message, &reply, NULL, 0);
+}
 
-	LOG_INF("Received info request");
+/* Information resource callbacks*/
+static int info_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			  size_t size)
+{
+	struct fw_version fw = srv_context.on_info_request(); // get firmware version from coap_server.c
+
+	ARG_UNUSED(request);
+
+	return info_payload_serialize(&fw, reply->format, buf, size);
+}
+
+/* Sensors resource callbacks*/
+/* Records of the /sensors pack, the ADC channels come after the fixed ones */
+enum sensors_record {
+	SENSORS_TEMPERATURE,
+	SENSORS_LIGHT,
+	SENSORS_PUMP_REMAINING,
+	SENSORS_INFO,
+	SENSORS_ADC,
+};
 
-	if ((otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) &&
-	    (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
-		msg_info = *message_info;
-		memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
+BUILD_ASSERT(SENSORS_ADC + SAMPLING_NUM_CHANNELS <= 32, "Too many ADC channels for /sensors");
 
-		info_response_send(message, &msg_info);
+static const char *const sensors_names[] = {
+	[SENSORS_TEMPERATURE] = TEMPERATURE_URI_PATH,
+	[SENSORS_LIGHT] = LIGHT_URI_PATH,
+	[SENSORS_PUMP_REMAINING] = SENSORS_PUMP_REMAINING_NAME,
+	[SENSORS_INFO] = INFO_URI_PATH,
+};
+
+/* Maps the "n=" queries to a mask of records, every record if there are none */
+static uint32_t sensors_selection(const struct coap_request *request)
+{
+	const char *query = NULL;
+	uint32_t mask = 0;
+	bool filtered = false;
+	size_t prefix = strlen(SENSORS_NAME_URI_QUERY "=");
+	size_t adc = strlen(SENSORS_ADC_NAME);
+
+	while ((query = coap_request_query_next(request, query)) != NULL) {
+		if (strncmp(query, SENSORS_NAME_URI_QUERY "=", prefix) != 0) {
+			continue;
+		}
+		filtered = true;
+
+		for (size_t i = 0; i < ARRAY_SIZE(sensors_names); i++) {
+			if (strcmp(&query[prefix], sensors_names[i]) == 0) {
+				mask |= BIT(i);
+			}
+		}
+
+		if (strncmp(&query[prefix], SENSORS_ADC_NAME, adc) == 0) {
+			unsigned long channel = strtoul(&query[prefix + adc], NULL, 10);
+
+			if (channel < SAMPLING_NUM_CHANNELS) {
+				mask |= BIT(SENSORS_ADC + channel);
+			}
+		}
 	}
-	else
-	{
-		LOG_INF("Bad info request type or code.");
+
+	return filtered ? mask : BIT_MASK(SENSORS_ADC + SAMPLING_NUM_CHANNELS);
+}
+
+static int sensors_payload_serialize(uint32_t mask, const struct sample_set *set,
+				     uint32_t pump_remaining_ms, const struct fw_version *fw,
+				     uint8_t *buf, size_t size)
+{
+	struct senml_writer writer;
+	char name[sizeof(SENSORS_ADC_NAME) + 3];
+
+	senml_begin(&writer, buf, size, __builtin_popcount(mask));
+
+	if (mask & BIT(SENSORS_TEMPERATURE)) {
+		senml_record(&writer, 3);
+		senml_name(&writer, sensors_names[SENSORS_TEMPERATURE]);
+		senml_unit(&writer, "Cel");
+		senml_decimal_value(&writer, set->temperature, -2);
 	}
+
+	if (mask & BIT(SENSORS_LIGHT)) {
+		senml_record(&writer, 2);
+		senml_name(&writer, sensors_names[SENSORS_LIGHT]);
+		senml_bool_value(&writer, coap_is_pump_active());
+	}
+
+	if (mask & BIT(SENSORS_PUMP_REMAINING)) {
+		senml_record(&writer, 3);
+		senml_name(&writer, sensors_names[SENSORS_PUMP_REMAINING]);
+		senml_unit(&writer, "s");
+		senml_value(&writer, DIV_ROUND_UP(pump_remaining_ms, MSEC_PER_SEC));
+	}
+
+	if (mask & BIT(SENSORS_INFO)) {
+		senml_record(&writer, 2);
+		senml_name(&writer, sensors_names[SENSORS_INFO]);
+		senml_string_value(&writer, fw->fw_version_buf);
+	}
+
+	for (size_t i = 0; i < SAMPLING_NUM_CHANNELS; i++) {
+		if (!(mask & BIT(SENSORS_ADC + i))) {
+			continue;
+		}
+		snprintf(name, sizeof(name), SENSORS_ADC_NAME "%d", (int)i);
+		senml_record(&writer, 3);
+		senml_name(&writer, name);
+		senml_unit(&writer, "mV");
+		senml_value(&writer, set->val_mv[i]);
+	}
+
+	return senml_end(&writer);
+}
+
+static int sensors_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			     size_t size)
+{
+	struct sample_set set;
+	struct fw_version fw;
+	uint32_t pump_remaining_ms = 0;
+	uint32_t mask;
+	int ret;
+
+	mask = sensors_selection(request);
+
+	ret = srv_context.on_sensors_request(coap_has_uri_query(request, FRESH_URI_QUERY),
+					     &set, &pump_remaining_ms);
+	if (ret != 0) {
+		// no sample yet
+		reply->code = OT_COAP_CODE_SERVICE_UNAVAILABLE;
+		return 0;
+	}
+
+	fw = srv_context.on_info_request();
+
+	coap_trace(COAP_TRACE_SENSORS, NULL, mask, 0);
+
+	return sensors_payload_serialize(mask, &set, pump_remaining_ms, &fw, buf, size);
 }
 
 /* Temperature resource callbacks*/
-static otError temperature_response_send(otMessage *request_message, const otMessageInfo *message_info)
+static int temperature_serialize(const struct coap_request *request, struct coap_reply *reply,
+				 uint8_t *buf, size_t size)
 {
-	otError error = OT_ERROR_NO_BUFS;
-	otMessage *response;
-	const void *payload;
-	uint16_t payload_size;
-	int8_t val = 0;
+	int32_t val = 0;
+	uint32_t max_age = 0;
+	int ret;
+
+	// get temperature from the sampling cache in coap_server.c
+	ret = srv_context.on_temperature_request(coap_has_uri_query(request, FRESH_URI_QUERY),
+						 &val, &max_age);
+	reply->max_age = max_age;
+
+	if (ret != 0) {
+		// no sample yet, let the client retry once the first one is in
+		coap_trace(COAP_TRACE_NO_SAMPLE, TEMPERATURE_URI_PATH, 0, 0);
+		reply->code = OT_COAP_CODE_SERVICE_UNAVAILABLE;
+		return 0;
+	}
 
-	val = srv_context.on_temperature_request(); // get temperature from coap_server.c
-	
-	response = otCoapNewMessage(srv_context.ot, NULL);
-	if (response == NULL) {
-		goto end;
+	reply->observable = &temperature_observable;
+	reply->observe_value = val;
+
+	coap_trace(COAP_TRACE_TEMPERATURE, NULL, MIN(max_age, UINT16_MAX), val);
+
+	return temperature_payload_serialize(val, reply->format, buf, size);
+}
+
+/* Light resource callbacks*/
+static int light_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			   size_t size)
+{
+	char value[11];
+	uint32_t duration = 0;
+	uint16_t group = 0;
+	uint8_t command;
+
+	if (request->multicast) {
+		// only act for the groups joined, the error response to others is suppressed
+		if (coap_request_query(request, GROUP_URI_QUERY, value, sizeof(value))) {
+			group = strtoul(value, NULL, 0);
+		}
+		if (!coap_group_match(group, &request->destination)) {
+			reply->code = OT_COAP_CODE_NOT_FOUND;
+			return 0;
+		}
 	}
 
-	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-			  OT_COAP_CODE_CONTENT);
+	if (request->code == OT_COAP_CODE_PUT) {
+		if (request->payload_len < 1) {
+			LOG_ERR("Light handler - Missing light command");
+			reply->code = OT_COAP_CODE_BAD_REQUEST;
+			return 0;
+		}
+		if (coap_request_query(request, DURATION_URI_QUERY, value, sizeof(value))) {
+			duration = strtoul(value, NULL, 0);
+		}
+		if (group != 0) {
+			coap_stats_inc(COAP_STATS_GROUP_COMMANDS);
+		}
+		command = request->payload[0];
+		srv_context.on_light_request(command, duration); // update light in coap_server.c
+		coap_trace(COAP_TRACE_LIGHT_PUT, NULL, command, group);
+		reply->code = OT_COAP_CODE_CHANGED;
+	} else {
+		reply->observable = &light_observable;
+		reply->observe_value = coap_is_pump_active();
+	}
 
-	error = otCoapMessageSetToken(
-		response, otCoapMessageGetToken(request_message),
-		otCoapMessageGetTokenLength(request_message));
-	if (error != OT_ERROR_NONE) {
-		goto end;
+	return light_payload_serialize(coap_is_pump_active(), reply->format, buf, size);
+}
+
+/* Schedule resource callbacks*/
+static int schedule_serialize(const struct coap_request *request, struct coap_reply *reply,
+			      uint8_t *buf, size_t size)
+{
+	struct pump_schedule_entry entries[CONFIG_COAP_SERVER_SCHEDULE_ENTRIES];
+	int32_t time_of_day = -1;
+	char value[11];
+	size_t count;
+
+	if (request->code == OT_COAP_CODE_PUT) {
+		if (request->payload_len % SCHEDULE_ENTRY_SIZE != 0) {
+			reply->code = OT_COAP_CODE_BAD_REQUEST;
+			return 0;
+		}
+
+		count = request->payload_len / SCHEDULE_ENTRY_SIZE;
+		for (size_t i = 0; i < count; i++) {
+			const uint8_t *entry = &request->payload[i * SCHEDULE_ENTRY_SIZE];
+
+			entries[i].start = sys_get_be32(entry);
+			entries[i].duration = sys_get_be16(&entry[4]);
+		}
+
+		if (coap_request_query(request, SCHEDULE_TIME_URI_QUERY, value, sizeof(value))) {
+			time_of_day = strtoul(value, NULL, 10);
+		}
+
+		// the whole upload is refused if one entry is invalid
+		reply->code = pump_schedule_set(entries, count, time_of_day) == 0 ?
+				      OT_COAP_CODE_CHANGED :
+				      OT_COAP_CODE_BAD_REQUEST;
+		return 0;
 	}
 
-	error = otCoapMessageSetPayloadMarker(response);
-	if (error != OT_ERROR_NONE) {
-		goto end;
+	count = pump_schedule_get(entries, ARRAY_SIZE(entries));
+	if (count * SCHEDULE_ENTRY_SIZE > size) {
+		return -ENOMEM;
 	}
 
-	payload = &val;
-	payload_size = sizeof(val);
+	for (size_t i = 0; i < count; i++) {
+		sys_put_be32(entries[i].start, &buf[i * SCHEDULE_ENTRY_SIZE]);
+		sys_put_be16(entries[i].duration, &buf[i * SCHEDULE_ENTRY_SIZE + 4]);
+	}
 
-	error = otMessageAppend(response, payload, payload_size);
-	if (error != OT_ERROR_NONE) {
-		goto end;
+	return count * SCHEDULE_ENTRY_SIZE;
+}
+
+/**@brief Reads the [offset, offset + len) window of a stream, returns the stream length. */
+typedef size_t (*block_reader_t)(void *context, size_t offset, uint8_t *buf, size_t len,
+				 size_t *written);
+
+static int well_known_core_serialize(const struct coap_request *request, struct coap_reply *reply,
+				     uint8_t *buf, size_t size);
+
+/* Returns the stream offset asked for with the Block2 option, and the size
+ * exponent of the block to answer with
+ */
+static size_t coap_get_block2(const struct coap_request *request, otCoapBlockSzx *szx)
+{
+	uint32_t block2;
+	size_t offset = 0;
+
+	*szx = CONFIG_COAP_SERVER_HISTORY_BLOCK_SZX;
+
+	// Block2: the client may ask for smaller blocks, never for larger ones
+	if (request != NULL && request->has_block2) {
+		block2 = request->block2;
+		offset = (size_t)(block2 >> 4) << ((block2 & 0x7) + 4);
+		*szx = MIN(*szx, (otCoapBlockSzx)(block2 & 0x7));
 	}
 
-	error = otCoapSendResponse(srv_context.ot, response, message_info);
+	return offset - offset % (1 << (*szx + 4));
+}
 
-	LOG_INF("Temperature response sent: %d degC", val);
+static int block2_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			    size_t size, block_reader_t reader, void *context)
+{
+	otCoapBlockSzx szx;
+	size_t offset;
+	size_t block_size;
+	size_t total;
+	size_t len = 0;
+
+	offset = coap_get_block2(request, &szx);
+	block_size = 1 << (szx + 4);
+
+	total = reader(context, offset, buf, MIN(block_size, size), &len);
+	if (offset >= total && offset != 0) {
+		// block past the end of the stream
+		reply->code = OT_COAP_CODE_BAD_OPTION;
+		return 0;
+	}
 
-end:
-	if (error != OT_ERROR_NONE && response != NULL) {
-		otMessageFree(response);
+	reply->block2 = true;
+	reply->block_num = offset / block_size;
+	reply->block_more = offset + len < total;
+	reply->block_szx = szx;
+	if (offset == 0) {
+		// size hint with the first block
+		reply->size2 = total;
 	}
 
-	return error;
+	coap_trace(COAP_TRACE_BLOCK, NULL, reply->block_num, len);
+
+	return len;
 }
-static void temperature_request_handler(void *context, otMessage *message, const otMessageInfo *message_info)
+
+/* History resource callbacks*/
+struct history_window {
+	int64_t since;
+	uint32_t epoch;
+};
+
+static size_t history_block_read(void *context, size_t offset, uint8_t *buf, size_t len,
+				 size_t *written)
 {
-	otError error;
-	otMessageInfo msg_info;
+	struct history_window *window = context;
 
-	ARG_UNUSED(context);
+	return sample_history_read(window->since, offset, buf, len, written, &window->epoch);
+}
 
-	LOG_INF("Received temperature request");
+static int history_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			     size_t size)
+{
+	struct history_window window = { 0 };
+	char since_str[21];
+	int ret;
+
+	if (coap_request_query(request, HISTORY_SINCE_URI_QUERY, since_str, sizeof(since_str))) {
+		window.since = strtoll(since_str, NULL, 10);
+	}
+
+	ret = block2_serialize(request, reply, buf, size, history_block_read, &window);
+
+	// the stream shifts when a segment is evicted, the client restarts on a new ETag
+	reply->has_etag = reply->block2;
+	reply->etag = window.epoch;
+
+	return ret;
+}
+
+/**@brief Pack encoded whole for the first block of a GET. The next blocks
+ * are read from it, so that the blocks of a transfer fit together.
+ */
+struct block_snapshot {
+	int (*encode)(uint8_t *buf, size_t size);
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	/* ETag of the pack, a block-0 GET of any client replaces it */
+	uint32_t etag;
+};
+
+static size_t snapshot_block_read(void *context, size_t offset, uint8_t *buf, size_t len,
+				  size_t *written)
+{
+	const struct block_snapshot *snapshot = context;
 
-	if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-	    (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
-		msg_info = *message_info;
-		memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
+	*written = offset < snapshot->len ? MIN(len, snapshot->len - offset) : 0;
+	memcpy(buf, &snapshot->buf[offset], *written);
 
-		temperature_response_send(message, &msg_info);
+	return snapshot->len;
+}
+
+/* Serves a snapshot block-wise under its ETag. Requests come from the
+ * OpenThread callback and from the work queue, so a snapshot is only touched
+ * with the OpenThread API lock held: coap_stats_senml() takes it too, a lock
+ * of our own would be taken in both orders.
+ */
+static int snapshot_serialize(const struct coap_request *request, struct coap_reply *reply,
+			      uint8_t *buf, size_t size, struct block_snapshot *snapshot)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otCoapBlockSzx szx;
+	int len;
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (coap_get_block2(request, &szx) == 0) {
+		len = snapshot->encode(snapshot->buf, snapshot->size);
+		if (len < 0) {
+			goto end;
+		}
+		snapshot->len = len;
+		snapshot->etag++;
 	}
-	else
+
+	len = block2_serialize(request, reply, buf, size, snapshot_block_read, snapshot);
+
+	// the client restarts if another one replaced the snapshot during its transfer
+	reply->has_etag = reply->block2;
+	reply->etag = snapshot->etag;
+
+end:
+	openthread_api_mutex_unlock(ot_context);
+
+	return len;
+}
+
+/* Stats resource callbacks*/
+static uint8_t stats_pack[STATS_SNAPSHOT_SIZE];
+static struct block_snapshot stats_snapshot = {
+	.encode = coap_stats_senml,
+	.buf = stats_pack,
+	.size = sizeof(stats_pack),
+};
+
+static int stats_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			   size_t size)
+{
+	return snapshot_serialize(request, reply, buf, size, &stats_snapshot);
+}
+
+/* Diag resource callbacks*/
+static uint8_t diag_pack[DIAG_SNAPSHOT_SIZE];
+static struct block_snapshot diag_snapshot = {
+	// only encodes the cached mesh snapshot, OpenThread is not queried here
+	.encode = mesh_diag_senml,
+	.buf = diag_pack,
+	.size = sizeof(diag_pack),
+};
+
+static int diag_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			  size_t size)
+{
+	return snapshot_serialize(request, reply, buf, size, &diag_snapshot);
+}
+
+static struct coap_static_payload info_payloads[ARRAY_SIZE(content_formats)];
+static struct coap_static_payload well_known_core_payloads[ARRAY_SIZE(content_formats)];
+
+#ifdef CONFIG_COAP_SERVER_SAMPLE_LOG
+/* Persistent log resource callbacks*/
+static size_t log_block_read(void *context, size_t offset, uint8_t *buf, size_t len,
+			     size_t *written)
+{
+	struct sample_log_cursor *cursor = context;
+	size_t total;
+	int ret;
+
+	// only one flash batch is held in RAM, whatever the size of the log
+	total = sample_log_cursor_init(cursor, offset);
+	ret = sample_log_cursor_read(cursor, buf, len);
+	*written = ret > 0 ? ret : 0;
+
+	return total;
+}
+
+static int log_serialize(const struct coap_request *request, struct coap_reply *reply, uint8_t *buf,
+			 size_t size)
+{
+	struct sample_log_cursor cursor;
+	int ret;
+
+	ret = block2_serialize(request, reply, buf, size, log_block_read, &cursor);
+
+	// overwriting the oldest batch shifts the stream, the client restarts on a new ETag
+	reply->has_etag = reply->block2;
+	reply->etag = cursor.tail;
+
+	return ret;
+}
+#endif /* CONFIG_COAP_SERVER_SAMPLE_LOG */
+
+#define TYPES_ANY (BIT(OT_COAP_TYPE_CONFIRMABLE) | BIT(OT_COAP_TYPE_NON_CONFIRMABLE))
+
+/**@brief Definition of the CoAP resources. */
+static struct coap_resource resources[] = {
+	{
+		.resource = { .mUriPath = LIGHT_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET) | BIT(OT_COAP_CODE_PUT),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW | FORMATS_SENML,
+		.observable = true,
+		.dedup = true,
+		.serialize = light_serialize,
+	},
+	{
+		.resource = { .mUriPath = SCHEDULE_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET) | BIT(OT_COAP_CODE_PUT),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW,
+		.dedup = true,
+		.serialize = schedule_serialize,
+	},
+	{
+		.resource = { .mUriPath = TEMPERATURE_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW | FORMATS_SENML,
+		.observable = true,
+		.serialize = temperature_serialize,
+	},
+	{
+		.resource = { .mUriPath = INFO_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW | FORMATS_SENML,
+		.serialize = info_serialize,
+		.payloads = info_payloads,
+	},
+	{
+		// a snapshot is only served as SenML
+		.resource = { .mUriPath = SENSORS_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_SENML,
+		.slow = true,
+		.serialize = sensors_serialize,
+	},
 	{
-		LOG_INF("Bad temperature request type or code.");
+		.resource = { .mUriPath = HISTORY_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW,
+		.serialize = history_serialize,
+	},
+#ifdef CONFIG_COAP_SERVER_SAMPLE_LOG
+	{
+		.resource = { .mUriPath = LOG_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_RAW,
+		.slow = true,
+		.serialize = log_serialize,
+	},
+#endif
+	{
+		.resource = { .mUriPath = STATS_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_SENML,
+		.serialize = stats_serialize,
+	},
+	{
+		.resource = { .mUriPath = DIAG_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_SENML,
+		.serialize = diag_serialize,
+	},
+	{
+		.resource = { .mUriPath = WELL_KNOWN_CORE_URI_PATH },
+		.methods = BIT(OT_COAP_CODE_GET),
+		.types = TYPES_ANY,
+		.formats = FORMATS_LINK,
+		.serialize = well_known_core_serialize,
+		.payloads = well_known_core_payloads,
+	},
+};
+
+/* a latency histogram per resource, plus the queue, coaps and adc ones */
+BUILD_ASSERT(ARRAY_SIZE(resources) + 3 <= COAP_STATS_HISTOGRAMS_MAX,
+	     "Raise COAP_STATS_HISTOGRAMS_MAX for the /stats pack");
+
+/* Well-known core resource callbacks*/
+static void link_format_append(uint8_t *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+	va_list args;
+
+	// keeps counting once full, like senml_writer
+	va_start(args, fmt);
+	if (*len < size) {
+		*len += vsnprintf((char *)&buf[*len], size - *len, fmt, args);
+	} else {
+		*len += vsnprintf(NULL, 0, fmt, args);
 	}
+	va_end(args);
 }
-/* Light resource callbacks*/
-static otError light_put_response_send(otMessage *request_message, const otMessageInfo *message_info)
+
+/* Link-format (RFC 6690) list of the resource table */
+static int well_known_core_serialize(const struct coap_request *request, struct coap_reply *reply,
+				     uint8_t *buf, size_t size)
 {
-	otError error = OT_ERROR_NO_BUFS;
-	otMessage *response;
-	const void *payload;
-	uint16_t payload_size;
-	uint8_t light_status;
+	size_t len = 0;
 
-	// create response message
-	response = otCoapNewMessage(srv_context.ot, NULL);
-	if (response == NULL) {
-		LOG_INF("Error in otCoapNewMessage()");
-		goto end;
+	ARG_UNUSED(request);
+	ARG_UNUSED(reply);
+
+	for (size_t i = 0; i < ARRAY_SIZE(resources); i++) {
+		const struct coap_resource *res = &resources[i];
+		const char *sep = "";
+		bool quoted = __builtin_popcount(res->formats) > 1;
+
+		if (res->serialize == well_known_core_serialize) {
+			continue;
+		}
+
+		link_format_append(buf, size, &len, "%s</%s>;ct=%s", len > 0 ? "," : "",
+				   res->resource.mUriPath, quoted ? "\"" : "");
+		for (size_t f = 0; f < ARRAY_SIZE(content_formats); f++) {
+			if (res->formats & BIT(f)) {
+				link_format_append(buf, size, &len, "%s%u", sep, content_formats[f]);
+				sep = " ";
+			}
+		}
+		link_format_append(buf, size, &len, "%s%s", quoted ? "\"" : "",
+				   res->observable ? ";obs" : "");
 	}
 
-	// init response message
-	otCoapMessageInitResponse(response, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT,
-			  OT_COAP_CODE_CHANGED);
+	// vsnprintf needs room for its terminating NUL
+	return len < size ? len : -ENOMEM;
+}
 
-	// set message payload marker
-	error = otCoapMessageSetPayloadMarker(response);
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otCoapMessageSetPayloadMarker()");
-		goto end;
+static uint32_t etag_compute(const uint8_t *data, size_t len, uint16_t format)
+{
+	// FNV-1a, seeded with the format so each representation gets its own tag
+	uint32_t hash = 2166136261u ^ format;
+
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ data[i]) * 16777619u;
 	}
 
-	// update payload
-	if (coap_is_pump_active())
-		light_status = 1;
-	else
-		light_status - 0;
-	payload = &light_status;
-	payload_size = sizeof(light_status);
+	return hash;
+}
 
-	error = otMessageAppend(response, payload, payload_size);
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otMessageAppend()");
-		goto end;
+/* Serializes every representation of the static resources once, with no request */
+static void static_payloads_init(void)
+{
+	static uint8_t static_payload_buf[STATIC_PAYLOADS_SIZE];
+	size_t used = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(resources); i++) {
+		struct coap_resource *res = &resources[i];
+
+		if (res->payloads == NULL) {
+			continue;
+		}
+
+		for (size_t f = 0; f < ARRAY_SIZE(content_formats); f++) {
+			struct coap_reply reply = {
+				.code = OT_COAP_CODE_CONTENT,
+				.format = content_formats[f],
+				.max_age = MAX_AGE_NONE,
+			};
+			int len;
+
+			if (!(res->formats & BIT(f))) {
+				continue;
+			}
+
+			len = res->serialize(NULL, &reply, &static_payload_buf[used],
+					     sizeof(static_payload_buf) - used);
+			if (len < 0) {
+				// still served, just serialized on every request
+				LOG_WRN("No room to precompute %s (format %d)", res->resource.mUriPath,
+					content_formats[f]);
+				continue;
+			}
+
+			res->payloads[f].data = &static_payload_buf[used];
+			res->payloads[f].len = len;
+			res->payloads[f].etag = etag_compute(res->payloads[f].data, len,
+							     content_formats[f]);
+			used += len;
+		}
 	}
 
-	error = otCoapSendResponse(srv_context.ot, response, message_info);
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otCoapSendResponse()");
-		goto end;
+	LOG_INF("Static payloads: %d of %d bytes", used, sizeof(static_payload_buf));
+}
+
+/* Admission control, on the OpenThread thread before anything costly is done */
+#ifdef CONFIG_COAP_SERVER_RATE_LIMIT
+struct rate_bucket {
+	bool used;
+	otIp6Address addr;
+	/* in RATE_TOKEN units */
+	uint32_t tokens;
+	/* k_uptime_get_32() of the last refill */
+	uint32_t refilled;
+};
+
+static struct rate_bucket rate_buckets[CONFIG_COAP_SERVER_RATE_LIMIT_PEERS];
+
+/* Takes a token from the bucket of the peer. Returns 0 on success, else the
+ * number of seconds until the next token.
+ */
+static uint32_t rate_limit_take(const otIp6Address *addr)
+{
+	struct rate_bucket *bucket = NULL;
+	struct rate_bucket *victim = NULL;
+	uint32_t now = k_uptime_get_32();
+	uint64_t tokens;
+
+	for (size_t i = 0; i < ARRAY_SIZE(rate_buckets); i++) {
+		struct rate_bucket *b = &rate_buckets[i];
+
+		if (b->used && otIp6IsAddressEqual(&b->addr, addr)) {
+			bucket = b;
+			break;
+		}
+		// a new peer takes a free bucket, else the one idle for the longest time
+		if (victim == NULL || !b->used ||
+		    (victim->used && (int32_t)(b->refilled - victim->refilled) < 0)) {
+			victim = b;
+		}
 	}
 
-	LOG_INF("Light PUT response sent: %d", light_status);
-	
-end:
-	if (error != OT_ERROR_NONE && response != NULL) {
-		LOG_INF("Couldn't send Light response");
-		otMessageFree(response);
+	if (bucket == NULL) {
+		bucket = victim;
+		bucket->used = true;
+		bucket->addr = *addr;
+		bucket->tokens = CONFIG_COAP_SERVER_RATE_LIMIT_BURST * RATE_TOKEN;
+		bucket->refilled = now;
 	}
 
-	return error;
+	// RATE requests per second is RATE tokens per ms
+	tokens = bucket->tokens + (uint64_t)(now - bucket->refilled) * CONFIG_COAP_SERVER_RATE_LIMIT_RATE;
+	bucket->tokens = MIN(tokens, CONFIG_COAP_SERVER_RATE_LIMIT_BURST * RATE_TOKEN);
+	bucket->refilled = now;
+
+	if (bucket->tokens >= RATE_TOKEN) {
+		bucket->tokens -= RATE_TOKEN;
+		return 0;
+	}
+
+	return DIV_ROUND_UP(RATE_TOKEN - bucket->tokens,
+			    CONFIG_COAP_SERVER_RATE_LIMIT_RATE * MSEC_PER_SEC);
 }
-static otError light_get_response_send(otMessage *request_message, const otMessageInfo *message_info)
+#else
+static uint32_t rate_limit_take(const otIp6Address *addr)
 {
-	otError error = OT_ERROR_NO_BUFS;
-	otMessage *response;
-	const void *payload;
-	uint16_t payload_size;
-	uint8_t val = coap_is_pump_active();
-	
-	response = otCoapNewMessage(srv_context.ot, NULL);
-	if (response == NULL) {
-		goto end;
+	ARG_UNUSED(addr);
+
+	return 0;
+}
+#endif /* CONFIG_COAP_SERVER_RATE_LIMIT */
+
+/* Keeps a reserve of message buffers for the Thread stack itself */
+static bool buffers_low(void)
+{
+	otBufferInfo info;
+
+	if (CONFIG_COAP_SERVER_MIN_FREE_BUFFERS == 0) {
+		return false;
 	}
 
-	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-			  OT_COAP_CODE_CONTENT);
+	otMessageGetBufferInfo(srv_context.ot, &info);
 
-	error = otCoapMessageSetToken(
-		response, otCoapMessageGetToken(request_message),
-		otCoapMessageGetTokenLength(request_message));
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otCoapMessageSetToken()");
-		goto end;
+	return info.mFreeBuffers < CONFIG_COAP_SERVER_MIN_FREE_BUFFERS;
+}
+
+/* Deduplication of retransmitted CON requests (RFC 7252, 4.5): the response
+ * is kept for EXCHANGE_LIFETIME and replayed instead of running the handler
+ * again. Only touched with the OpenThread API lock held.
+ */
+enum dedup_state {
+	DEDUP_FREE,
+	/* handler queued or running, the request has been acknowledged or is about to be */
+	DEDUP_PENDING,
+	DEDUP_DONE,
+};
+
+struct dedup_entry {
+	enum dedup_state state;
+	otIp6Address addr;
+	uint16_t port;
+	uint16_t message_id;
+	/* k_uptime_get_32() past which no retransmission can come */
+	uint32_t expiry;
+	struct coap_reply reply;
+	uint8_t len;
+	uint8_t payload[DEDUP_PAYLOAD_MAX_SIZE];
+};
+
+static struct dedup_entry dedup_cache[CONFIG_COAP_SERVER_DEDUP_ENTRIES];
+
+static bool dedup_expired(const struct dedup_entry *entry, uint32_t now)
+{
+	return entry->state == DEDUP_DONE && (int32_t)(now - entry->expiry) >= 0;
+}
+
+static struct dedup_entry *dedup_find(const struct coap_request *request, uint16_t message_id)
+{
+	uint32_t now = k_uptime_get_32();
+
+	for (size_t i = 0; i < ARRAY_SIZE(dedup_cache); i++) {
+		struct dedup_entry *entry = &dedup_cache[i];
+
+		if (entry->state != DEDUP_FREE && !dedup_expired(entry, now) &&
+		    entry->message_id == message_id &&
+		    entry->port == request->message_info.mPeerPort &&
+		    otIp6IsAddressEqual(&entry->addr, &request->message_info.mPeerAddr)) {
+			return entry;
+		}
 	}
 
-	error = otCoapMessageSetPayloadMarker(response);
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otCoapMessageSetPayloadMarker()");
-		goto end;
+	return NULL;
+}
+
+/* Takes a free or expired entry, else the completed one closest to expiry.
+ * Returns NULL if every entry is pending.
+ */
+static struct dedup_entry *dedup_insert(const struct coap_request *request, uint16_t message_id)
+{
+	struct dedup_entry *victim = NULL;
+	uint32_t now = k_uptime_get_32();
+
+	for (size_t i = 0; i < ARRAY_SIZE(dedup_cache); i++) {
+		struct dedup_entry *entry = &dedup_cache[i];
+
+		if (entry->state == DEDUP_FREE || dedup_expired(entry, now)) {
+			victim = entry;
+			break;
+		}
+		if (entry->state == DEDUP_DONE &&
+		    (victim == NULL || (int32_t)(entry->expiry - victim->expiry) < 0)) {
+			victim = entry;
+		}
 	}
 
-	payload = &val;
-	payload_size = sizeof(val);
+	if (victim != NULL) {
+		victim->state = DEDUP_PENDING;
+		victim->addr = request->message_info.mPeerAddr;
+		victim->port = request->message_info.mPeerPort;
+		victim->message_id = message_id;
+	}
 
-	error = otMessageAppend(response, payload, payload_size);
-	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otMessageAppend()");
-		goto end;
+	return victim;
+}
+
+/* Keeps the response of a handled request for its retransmissions */
+static void dedup_complete(struct dedup_entry *entry, const struct coap_reply *reply,
+			   const uint8_t *payload, size_t len)
+{
+	if (entry == NULL) {
+		return;
+	}
+
+	if (len > sizeof(entry->payload)) {
+		// not replayable, a retransmission runs the handler again
+		LOG_WRN("Response of %d bytes too large to replay", len);
+		entry->state = DEDUP_FREE;
+		return;
+	}
+
+	entry->state = DEDUP_DONE;
+	entry->expiry = k_uptime_get_32() + EXCHANGE_LIFETIME_MS;
+	entry->reply = *reply;
+	entry->len = len;
+	memcpy(entry->payload, payload, len);
+}
+
+static void dedup_replay(const struct dedup_entry *entry, const struct coap_request *request,
+			 const otMessage *message)
+{
+	if (entry->state == DEDUP_PENDING) {
+		// still queued, its separate response answers the retransmission too
+		return;
+	}
+
+	coap_response_send(request, message, &entry->reply, entry->payload, entry->len);
+}
+
+/* Request pipeline: the OpenThread callback parses and validates a request
+ * and answers it when its serializer only reads RAM. The request work queue
+ * runs the ones that may block, and sends their responses.
+ */
+struct coap_job {
+	/* scheduled without delay, then again with the leisure of a multicast response */
+	struct k_work_delayable work;
+	struct coap_resource *res;
+	struct coap_request request;
+	struct coap_reply reply;
+	/* k_cycle_get_32() when the request came in */
+	uint32_t start;
+	/* keeps the response for retransmissions, NULL if not deduplicated */
+	struct dedup_entry *dedup;
+	bool serialized;
+	int len;
+	uint8_t payload[PAYLOAD_MAX_SIZE];
+};
+
+K_THREAD_STACK_DEFINE(request_stack, CONFIG_COAP_SERVER_REQUEST_STACK_SIZE);
+
+static struct k_work_q request_q;
+static struct coap_job jobs[CONFIG_COAP_SERVER_REQUEST_QUEUE_DEPTH];
+static ATOMIC_DEFINE(jobs_used, CONFIG_COAP_SERVER_REQUEST_QUEUE_DEPTH);
+/* response of the requests serialized on the OpenThread thread */
+static uint8_t inline_payload[PAYLOAD_MAX_SIZE];
+/* time a request waits for the work queue */
+static struct coap_stats_histogram queue_latency;
+#ifdef CONFIG_COAP_SERVER_SECURE
+/* latency of the CoAPS requests, response encryption included */
+static struct coap_stats_histogram secure_latency;
+#endif
+
+static struct coap_job *job_alloc(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+		if (!atomic_test_and_set_bit(jobs_used, i)) {
+			return &jobs[i];
+		}
 	}
 
-	error = otCoapSendResponse(srv_context.ot, response, message_info);
+	return NULL;
+}
+
+static void job_free(struct coap_job *job)
+{
+	atomic_clear_bit(jobs_used, job - jobs);
+}
+
+/* Sends the response of a resource and records its latency since the request came in */
+static void resource_response_send(struct coap_resource *res, const struct coap_request *request,
+				   const otMessage *message, const struct coap_reply *reply,
+				   const uint8_t *payload, size_t len, uint32_t start)
+{
+	otError error;
+
+	error = coap_response_send(request, message, reply, payload, len);
 	if (error != OT_ERROR_NONE) {
-		LOG_INF("Error in otCoapSendResponse()");
-		goto end;
+		coap_trace(COAP_TRACE_SEND_FAILED, res->resource.mUriPath, 0, error);
+	} else {
+		coap_trace(COAP_TRACE_RESPONSE, res->resource.mUriPath, reply->code, len);
 	}
 
-	LOG_INF("Light GET response sent: %d", val);
+	coap_stats_record(&res->latency, start);
+#ifdef CONFIG_COAP_SERVER_SECURE
+	if (request->secure) {
+		coap_stats_record(&secure_latency, start);
+	}
+#endif
+}
 
-end:
-	if (error != OT_ERROR_NONE && response != NULL) {
-		otMessageFree(response);
-		LOG_INF("Couldn't send Light GET response");
+/* Answers 5.03 with a Max-Age telling the client when to come back */
+static void coap_busy_response_send(const struct coap_request *request, const otMessage *message,
+				    uint32_t max_age)
+{
+	const struct coap_reply reply = {
+		.code = OT_COAP_CODE_SERVICE_UNAVAILABLE,
+		.max_age = max_age,
+	};
+
+	coap_response_send(request, message, &reply, NULL, 0);
+}
+
+/* Runs the serializer of a resource, a failure is answered 5.00 */
+static int resource_serialize(struct coap_resource *res, const struct coap_request *request,
+			      struct coap_reply *reply, uint8_t *buf, size_t size)
+{
+	int len;
+
+	len = res->serialize(request, reply, buf, size);
+	if (len < 0) {
+		LOG_ERR("Could not serialize %s (%d)", res->resource.mUriPath, len);
+		coap_stats_inc(COAP_STATS_SERIALIZE_ERRORS);
+		*reply = (struct coap_reply){
+			.code = OT_COAP_CODE_INTERNAL_ERROR,
+			.max_age = MAX_AGE_NONE,
+		};
+		len = 0;
 	}
 
-	return error;
+	return len;
 }
-static void light_request_handler(void *context, otMessage *message, const otMessageInfo *message_info)
+
+/* True if the request is handed to the work queue: its serializer may block
+ * on flash or a fresh sample, or its response waits for the leisure of a
+ * multicast request or the wake window of a sleepy node
+ */
+static bool coap_request_deferred(const struct coap_resource *res,
+				  const struct coap_request *request)
 {
-	uint8_t command;
-	otMessageInfo msg_info;
+	if (res->slow || request->multicast || coap_has_uri_query(request, FRESH_URI_QUERY)) {
+		return true;
+	}
 
-	uint8_t isTypePut = 0;
+	return IS_ENABLED(CONFIG_COAP_SERVER_SLEEPY) &&
+	       request->type == OT_COAP_TYPE_NON_CONFIRMABLE;
+}
 
-	ARG_UNUSED(context);
+/* Serializes the response of a job, or a 5.03 if it waited too long */
+static void job_serialize(struct coap_job *job)
+{
+	const char *uri = job->res->resource.mUriPath;
+	uint32_t waited_ms;
+
+	coap_stats_record(&queue_latency, job->start);
+	waited_ms = k_cyc_to_ms_floor32(k_cycle_get_32() - job->start);
+
+	if (waited_ms > CONFIG_COAP_SERVER_REQUEST_DEADLINE) {
+		// the client has retransmitted or given up by now, skip the callbacks
+		coap_stats_inc(COAP_STATS_DEADLINE_MISSED);
+		coap_trace(COAP_TRACE_DEADLINE_MISSED, uri, 0, waited_ms);
+		job->reply.code = OT_COAP_CODE_SERVICE_UNAVAILABLE;
+		job->reply.max_age = BUSY_MAX_AGE;
+		job->len = 0;
+	} else {
+		job->len = resource_serialize(job->res, &job->request, &job->reply, job->payload,
+					      sizeof(job->payload));
+	}
 
-	if ((otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) && (otCoapMessageGetCode(message) == OT_COAP_CODE_PUT))
-	{
-		isTypePut = 1;
+	job->serialized = true;
+}
+
+static void job_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct coap_job *job = CONTAINER_OF(dwork, struct coap_job, work);
+	struct openthread_context *ot_context = openthread_get_default_context();
+
+	if (!job->serialized) {
+		job_serialize(job);
+
+		if (job->request.multicast && CONFIG_COAP_SERVER_MULTICAST_LEISURE > 0 &&
+		    !coap_response_suppressed(&job->request, job->reply.code)) {
+			// spread the responses of the group members over the leisure
+			k_work_schedule_for_queue(
+				&request_q, &job->work,
+				K_MSEC(sys_rand32_get() % (CONFIG_COAP_SERVER_MULTICAST_LEISURE + 1)));
+			return;
+		}
 	}
-	else if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) && (otCoapMessageGetCode(message) == OT_COAP_CODE_GET))
-	{
-		isTypePut = 0;
+
+	// a NON response, or the separate response of a CON request
+	openthread_api_mutex_lock(ot_context);
+	resource_response_send(job->res, &job->request, NULL, &job->reply, job->payload, job->len,
+			       job->start);
+	dedup_complete(job->dedup, &job->reply, job->payload, job->len);
+	openthread_api_mutex_unlock(ot_context);
+
+	job_free(job);
+}
+
+static void coap_request_handle(struct coap_resource *res, otMessage *message,
+				const otMessageInfo *message_info, bool secure)
+{
+	uint32_t start = k_cycle_get_32();
+	struct coap_request request;
+	struct coap_reply reply = {
+		.code = OT_COAP_CODE_CONTENT,
+		.max_age = MAX_AGE_NONE,
+	};
+	struct coap_job *job;
+	struct dedup_entry *dedup = NULL;
+	uint16_t message_id = otCoapMessageGetMessageId(message);
+	bool dedup_candidate;
+	uint32_t retry_after;
+	int format;
+	int ret;
+
+	coap_stats_inc(COAP_STATS_REQUESTS);
+
+	ret = coap_request_parse(&request, message, message_info);
+	request.secure = secure;
+	coap_trace(COAP_TRACE_REQUEST, res->resource.mUriPath, request.type << 8 | request.code,
+		   message_id);
+
+	// multicast requests must be NON (RFC 7252 section 8.1)
+	if (!(res->types & BIT(request.type)) ||
+	    (request.multicast && request.type == OT_COAP_TYPE_CONFIRMABLE)) {
+		coap_trace(COAP_TRACE_BAD_TYPE, res->resource.mUriPath,
+			   request.type << 8 | request.code, 0);
+		coap_stats_inc(COAP_STATS_BAD_TYPE);
+		goto end;
 	}
-	else
-	{
-		LOG_INF("Bad light request type/code.");
+
+	// a retransmission of a request that was handled is answered whatever the limits
+	dedup_candidate = ret == 0 && res->dedup && request.type == OT_COAP_TYPE_CONFIRMABLE &&
+			  request.code != OT_COAP_CODE_GET;
+	if (dedup_candidate) {
+		dedup = dedup_find(&request, message_id);
+		if (dedup != NULL) {
+			coap_stats_inc(COAP_STATS_DEDUP_HITS);
+			coap_trace(COAP_TRACE_DUPLICATE, res->resource.mUriPath, 0, message_id);
+			dedup_replay(dedup, &request, message);
+			goto end;
+		}
+	}
+
+	retry_after = rate_limit_take(&request.message_info.mPeerAddr);
+	if (retry_after > 0) {
+		coap_stats_inc(COAP_STATS_RATE_LIMITED);
+		coap_trace(COAP_TRACE_REJECTED, res->resource.mUriPath, COAP_TRACE_REJECT_RATE,
+			   retry_after);
+		coap_busy_response_send(&request, message, retry_after);
 		goto end;
 	}
 
-	msg_info = *message_info;
-	memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
+	if (buffers_low()) {
+		coap_stats_inc(COAP_STATS_LOW_BUFFERS);
+		coap_trace(COAP_TRACE_REJECTED, res->resource.mUriPath, COAP_TRACE_REJECT_BUFFERS,
+			   BUSY_MAX_AGE);
+		coap_busy_response_send(&request, message, BUSY_MAX_AGE);
+		goto end;
+	}
 
-	if (isTypePut) {
-		if (otMessageRead(message, otMessageGetOffset(message), &command, 1) != 1) {
-			LOG_ERR("Light handler - Missing light command");
-			goto end;
+	if (ret < 0) {
+		coap_stats_inc(COAP_STATS_TOO_LARGE);
+		coap_error_response_send(&request, message, ret == -EMSGSIZE ?
+						    OT_COAP_CODE_REQUEST_TOO_LARGE :
+						    OT_COAP_CODE_BAD_OPTION);
+		goto end;
+	}
+
+	if (request.code >= 8 * sizeof(res->methods) || !(res->methods & BIT(request.code))) {
+		coap_stats_inc(COAP_STATS_BAD_METHOD);
+		coap_error_response_send(&request, message, OT_COAP_CODE_METHOD_NOT_ALLOWED);
+		goto end;
+	}
+
+	if (IS_ENABLED(CONFIG_COAP_SERVER_SECURE_WRITES) && request.code != OT_COAP_CODE_GET &&
+	    !request.secure) {
+		// only an authenticated peer may switch the pump
+		coap_stats_inc(COAP_STATS_UNAUTHORIZED);
+		coap_error_response_send(&request, message, OT_COAP_CODE_UNAUTHORIZED);
+		goto end;
+	}
+
+	format = coap_get_accept(&request, res->formats);
+	if (format < 0) {
+		coap_stats_inc(COAP_STATS_NOT_ACCEPTABLE);
+		coap_error_response_send(&request, message, OT_COAP_CODE_NOT_ACCEPTABLE);
+		goto end;
+	}
+	reply.format = content_formats[format];
+
+	if (dedup_candidate) {
+		coap_stats_inc(COAP_STATS_DEDUP_MISSES);
+		// NULL if every entry is pending, the request is then handled without
+		dedup = dedup_insert(&request, message_id);
+	}
+
+	// multicast responses go through the work queue for their leisure
+	if (!request.multicast && res->payloads != NULL && res->payloads[format].data != NULL) {
+		const struct coap_static_payload *cached = &res->payloads[format];
+
+		// no application callback involved, answered right away
+		reply.has_etag = true;
+		reply.etag = cached->etag;
+		reply.max_age = CONFIG_COAP_SERVER_STATIC_MAX_AGE;
+
+		if (coap_etag_match(&request, cached->etag)) {
+			// the client's copy is still current
+			reply.code = OT_COAP_CODE_VALID;
+			resource_response_send(res, &request, message, &reply, NULL, 0, start);
+		} else {
+			resource_response_send(res, &request, message, &reply, cached->data,
+					       cached->len, start);
 		}
-		srv_context.on_light_request(command); // update light in coap_server.c
-		LOG_INF("Received light PUT request: %c", command);
-		light_put_response_send(message, &msg_info);
+		return;
 	}
-	else {
-		LOG_INF("Received light GET request");
-		light_get_response_send(message, &msg_info);
+
+	if (!coap_request_deferred(res, &request)) {
+		// only reads RAM, answered right away and piggybacked on the ACK of a CON request
+		ret = resource_serialize(res, &request, &reply, inline_payload,
+					 sizeof(inline_payload));
+		resource_response_send(res, &request, message, &reply, inline_payload, ret, start);
+		dedup_complete(dedup, &reply, inline_payload, ret);
+		return;
 	}
 
-end:
+	job = job_alloc();
+	if (job == NULL) {
+		// the work queue is behind, ask the client to come back later
+		coap_stats_inc(COAP_STATS_QUEUE_FULL);
+		coap_trace(COAP_TRACE_REJECTED, res->resource.mUriPath, COAP_TRACE_REJECT_QUEUE,
+			   BUSY_MAX_AGE);
+		coap_busy_response_send(&request, message, BUSY_MAX_AGE);
+		if (dedup != NULL) {
+			// not handled, a retransmission may try again
+			dedup->state = DEDUP_FREE;
+		}
+		goto end;
+	}
+
+	job->res = res;
+	job->request = request;
+	job->reply = reply;
+	job->start = start;
+	job->dedup = dedup;
+	job->serialized = false;
+#ifdef CONFIG_COAP_SERVER_SLEEPY
+	// CON clients wait for their response, NON ones are answered with the others of the window
+	k_work_schedule_for_queue(&request_q, &job->work,
+				  request.type == OT_COAP_TYPE_CONFIRMABLE ? K_NO_WAIT :
+									     sleepy_window_delay());
+#else
+	k_work_schedule_for_queue(&request_q, &job->work, K_NO_WAIT);
+#endif
+
+	if (request.type == OT_COAP_TYPE_CONFIRMABLE) {
+		// not waited for, the work queue sends a separate response
+		coap_stats_inc(COAP_STATS_SEPARATE_RESPONSES);
+		coap_trace(COAP_TRACE_SEPARATE, res->resource.mUriPath, 0, message_id);
+	}
 	return;
+
+end:
+	coap_stats_record(&res->latency, start);
 }
 
+static void coap_request_handler(void *context, otMessage *message, const otMessageInfo *message_info)
+{
+	coap_request_handle(context, message, message_info, false);
+}
 
 static void coap_default_handler(void *context, otMessage *message,
 				 const otMessageInfo *message_info)
 {
 	ARG_UNUSED(context);
-	ARG_UNUSED(message);
 	ARG_UNUSED(message_info);
 
-	LOG_INF("Received CoAP message that does not match any request "
-		"or resource");
+	coap_stats_inc(COAP_STATS_UNKNOWN_RESOURCE);
+	coap_trace(COAP_TRACE_UNKNOWN_RESOURCE, NULL,
+		   otCoapMessageGetType(message) << 8 | otCoapMessageGetCode(message),
+		   otCoapMessageGetMessageId(message));
+}
+
+#ifdef CONFIG_COAP_SERVER_SECURE
+/* OpenThread keeps a single DTLS session: it is kept across requests so a
+ * gateway pays for the handshake once, and closed once idle to let others in.
+ */
+static otCoapResource secure_resources[ARRAY_SIZE(resources)];
+static struct k_work_delayable secure_idle_work;
+/* k_uptime_get_32() when the session came up */
+static uint32_t secure_connected_at;
+
+static void secure_idle_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+
+	ARG_UNUSED(work);
+
+	openthread_api_mutex_lock(ot_context);
+	if (otCoapSecureIsConnected(srv_context.ot)) {
+		otCoapSecureDisconnect(srv_context.ot);
+	}
+	openthread_api_mutex_unlock(ot_context);
+}
+
+static void secure_idle_reschedule(void)
+{
+	if (CONFIG_COAP_SERVER_SECURE_IDLE_TIMEOUT > 0) {
+		k_work_reschedule(&secure_idle_work, K_SECONDS(CONFIG_COAP_SERVER_SECURE_IDLE_TIMEOUT));
+	}
+}
+
+static void secure_connect_handler(bool connected, void *context)
+{
+	ARG_UNUSED(context);
+
+	if (connected) {
+		secure_connected_at = k_uptime_get_32();
+		coap_stats_inc(COAP_STATS_SECURE_SESSIONS);
+		secure_idle_reschedule();
+	} else {
+		k_work_cancel_delayable(&secure_idle_work);
+	}
+
+	coap_trace(COAP_TRACE_SECURE_SESSION, NULL, connected,
+		   connected ? 0 : (k_uptime_get_32() - secure_connected_at) / MSEC_PER_SEC);
 }
 
+static void coap_secure_request_handler(void *context, otMessage *message,
+					const otMessageInfo *message_info)
+{
+	secure_idle_reschedule();
+	coap_request_handle(context, message, message_info, true);
+}
 
-int ot_coap_init(light_request_callback_t on_light_request, temperature_request_callback_t on_temperature_request, info_request_callback_t on_info_request)
+static otError coap_secure_start(void)
+{
+	static const char psk[] = CONFIG_COAP_SERVER_SECURE_PSK;
+	static const char identity[] = CONFIG_COAP_SERVER_SECURE_PSK_IDENTITY;
+
+	if (sizeof(psk) <= 1) {
+		LOG_ERR("CONFIG_COAP_SERVER_SECURE_PSK is not set");
+		return OT_ERROR_INVALID_ARGS;
+	}
+
+	k_work_init_delayable(&secure_idle_work, secure_idle_handler);
+	coap_stats_histogram_register(&secure_latency, "coaps");
+
+	otCoapSecureSetPsk(srv_context.ot, (const uint8_t *)psk, sizeof(psk) - 1,
+			   (const uint8_t *)identity, sizeof(identity) - 1);
+	otCoapSecureSetClientConnectedCallback(srv_context.ot, secure_connect_handler, NULL);
+	otCoapSecureSetDefaultHandler(srv_context.ot, coap_default_handler, NULL);
+
+	// an otCoapResource is a list node, the secure agent needs its own copies
+	for (size_t i = 0; i < ARRAY_SIZE(resources); i++) {
+		secure_resources[i] = resources[i].resource;
+		secure_resources[i].mHandler = coap_secure_request_handler;
+		secure_resources[i].mContext = &resources[i];
+		secure_resources[i].mNext = NULL;
+		otCoapSecureAddResource(srv_context.ot, &secure_resources[i]);
+	}
+
+	return otCoapSecureStart(srv_context.ot, COAPS_PORT);
+}
+#endif /* CONFIG_COAP_SERVER_SECURE */
+
+
+int ot_coap_init(light_request_callback_t on_light_request, temperature_request_callback_t on_temperature_request,
+		 info_request_callback_t on_info_request, sensors_request_callback_t on_sensors_request)
 {
 	otError error;
 	srv_context.on_light_request = on_light_request;
 	srv_context.on_temperature_request = on_temperature_request;
 	srv_context.on_info_request = on_info_request;
+	srv_context.on_sensors_request = on_sensors_request;
 
 	srv_context.ot = openthread_get_default_instance();
 	if (!srv_context.ot) {
@@ -395,15 +1782,28 @@ int ot_coap_init(light_request_callback_t on_light_request, temperature_request_
 		goto end;
 	}
 
-	light_resource.mContext = srv_context.ot;
-	light_resource.mHandler = light_request_handler;
+	coap_observe_init(srv_context.ot);
+	coap_stats_init(srv_context.ot);
+	(void)coap_group_init(srv_context.ot);
+	static_payloads_init();
 
-	temperature_resource.mContext = srv_context.ot;
-	temperature_resource.mHandler = temperature_request_handler;
+	k_work_queue_start(&request_q, request_stack, K_THREAD_STACK_SIZEOF(request_stack),
+			   CONFIG_COAP_SERVER_REQUEST_PRIORITY, NULL);
+	k_thread_name_set(&request_q.thread, "coap_requests");
+
+	for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+		k_work_init_delayable(&jobs[i].work, job_work_handler);
+	}
+	coap_stats_histogram_register(&queue_latency, "queue");
 
 	otCoapSetDefaultHandler(srv_context.ot, coap_default_handler, NULL);
-	otCoapAddResource(srv_context.ot, &light_resource);
-	otCoapAddResource(srv_context.ot, &temperature_resource);
+
+	for (size_t i = 0; i < ARRAY_SIZE(resources); i++) {
+		resources[i].resource.mHandler = coap_request_handler;
+		resources[i].resource.mContext = &resources[i];
+		coap_stats_histogram_register(&resources[i].latency, resources[i].resource.mUriPath);
+		otCoapAddResource(srv_context.ot, &resources[i].resource);
+	}
 
 	error = otCoapStart(srv_context.ot, COAP_PORT);
 	if (error != OT_ERROR_NONE) {
@@ -412,6 +1812,15 @@ int ot_coap_init(light_request_callback_t on_light_request, temperature_request_
 	}
 	LOG_INF("Coap Server has started");
 
+#ifdef CONFIG_COAP_SERVER_SECURE
+	error = coap_secure_start();
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to start OT CoAP secure. Error: %d", error);
+		goto end;
+	}
+	LOG_INF("CoAPS endpoint on port %d", COAPS_PORT);
+#endif
+
 end:
 	return error == OT_ERROR_NONE ? 0 : 1;
 }
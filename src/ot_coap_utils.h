@@ -7,14 +7,50 @@
 #ifndef __OT_COAP_UTILS_H__
 #define __OT_COAP_UTILS_H__
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <coap_server_client_interface.h>
 
+#include "sampling.h"
+
+/**@brief Firmware version served on /info. */
+struct fw_version {
+	// FW version
+	const char * fw_version_buf;
+	uint8_t fw_version_size;
+};
+
 /**@brief Type definition of the function used to handle light resource change.
+ *
+ * @param cmd        light_command.
+ * @param duration_s how long an ON command lasts, 0 for the default.
+ */
+typedef void (*light_request_callback_t)(uint8_t cmd, uint32_t duration_s);
+/**@brief Type definition of the function used to read the cached temperature.
+ *
+ * @param fresh   take a new sample before answering instead of using the cache.
+ * @param val     temperature read from the cache, in 0.01 degC.
+ * @param max_age remaining freshness of the value in seconds.
  */
-typedef void (*light_request_callback_t)(uint8_t cmd);
-typedef int8_t (*temperature_request_callback_t)();
+typedef int (*temperature_request_callback_t)(bool fresh, int32_t *val, uint32_t *max_age);
 typedef struct fw_version (*info_request_callback_t)();
-int ot_coap_init(light_request_callback_t on_light_request, temperature_request_callback_t, info_request_callback_t);
+/**@brief Type definition of the function used to read the /sensors snapshot.
+ *
+ * @param fresh             take a new sample before answering instead of using the cache.
+ * @param set               every ADC channel from the sampling cache.
+ * @param pump_remaining_ms time left before the pump timer switches the pump off.
+ */
+typedef int (*sensors_request_callback_t)(bool fresh, struct sample_set *set,
+					  uint32_t *pump_remaining_ms);
+int ot_coap_init(light_request_callback_t on_light_request, temperature_request_callback_t,
+		 info_request_callback_t, sensors_request_callback_t);
+
+
+void coap_activate_pump(void);
+void coap_diactivate_pump(void);
+bool coap_is_pump_active(void);
 
+/**@brief Let /temperature observers know a new sample is in the cache. */
+void coap_notify_temperature(void);
 
 #endif
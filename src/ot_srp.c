@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/random/random.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/srp_client.h>
+#include <openthread/srp_client_buffers.h>
+#include <openthread/thread.h>
+
+#include "boot_phase.h"
+#include "coap_stats.h"
+#include "coap_trace.h"
+#include "ot_srp.h"
+#include "ot_srp_config.h"
+
+LOG_MODULE_REGISTER(ot_srp, CONFIG_COAP_SERVER_LOG_LEVEL);
+
+#define SETTINGS_KEY "srp/names"
+#define NAME_SIZE 64
+#define SERVICE_PORT 49154
+
+/* Persisted as one blob, so the names and the suffix count always match */
+struct srp_names {
+	/* names found taken so far, selects the suffix of the next one */
+	uint32_t attempt;
+	char host[NAME_SIZE];
+	char instance[NAME_SIZE];
+};
+
+static otInstance *ot;
+static struct srp_names names;
+static bool names_loaded;
+static uint32_t device_id;
+
+/* the host and service are handed to the SRP client, guarded by the OpenThread lock */
+static bool configured;
+/* set from the SRP callback, the names are replaced by the next registration */
+static bool rename_pending;
+static uint32_t backoff_ms = CONFIG_COAP_SERVER_SRP_BACKOFF_MIN;
+
+/* time to registered after the last attach */
+static bool attached;
+static bool registered;
+static uint32_t attached_at;
+static uint32_t last_ms;
+static uint32_t worst_ms;
+
+static void register_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(register_work, register_work_handler);
+
+static int srp_settings_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+	ssize_t ret;
+
+	if (strcmp(key, "names") != 0) {
+		return -ENOENT;
+	}
+
+	if (len != sizeof(names)) {
+		/* written by another layout, generate new names */
+		return 0;
+	}
+
+	ret = read_cb(cb_arg, &names, sizeof(names));
+	if (ret < 0) {
+		return ret;
+	}
+
+	names.host[NAME_SIZE - 1] = '\0';
+	names.instance[NAME_SIZE - 1] = '\0';
+	names_loaded = true;
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(ot_srp, "srp", NULL, srp_settings_set, NULL, NULL);
+
+/* Low 32 bits of the hardware ID (FICR DEVICEID[0] on nRF), random if the board has none */
+static uint32_t srp_device_id(void)
+{
+	uint8_t id[8];
+	ssize_t len;
+
+	len = hwinfo_get_device_id(id, sizeof(id));
+	if (len < (ssize_t)sizeof(uint32_t)) {
+		return sys_rand32_get();
+	}
+
+	return sys_get_be32(&id[len - sizeof(uint32_t)]);
+}
+
+/* Names after the nth duplicate: derived from the device ID so that two nodes
+ * that collided do not collide again, and the same on every boot.
+ */
+static void names_generate(uint32_t attempt)
+{
+	uint32_t suffix;
+
+	if (attempt > 0) {
+		suffix = device_id ^ (attempt * 0x9e3779b9U);
+		suffix = (suffix ^ (suffix >> 16)) & 0xffff;
+		snprintf(names.host, sizeof(names.host), "%s-%04x", SRP_CLIENT_HOSTNAME, suffix);
+		snprintf(names.instance, sizeof(names.instance), "%s-%04x",
+			 SRP_CLIENT_SERVICE_INSTANCE, suffix);
+	} else if (IS_ENABLED(SRP_CLIENT_UNIQUE)) {
+		snprintf(names.host, sizeof(names.host), "%s-%x", SRP_CLIENT_HOSTNAME, device_id);
+		snprintf(names.instance, sizeof(names.instance), "%s-%x",
+			 SRP_CLIENT_SERVICE_INSTANCE, device_id);
+	} else if (IS_ENABLED(SRP_CLIENT_RNG)) {
+		uint32_t rn = sys_rand32_get();
+
+		snprintf(names.host, sizeof(names.host), "%s-%x", SRP_CLIENT_HOSTNAME, rn);
+		snprintf(names.instance, sizeof(names.instance), "%s-%x",
+			 SRP_CLIENT_SERVICE_INSTANCE, rn);
+	} else {
+		snprintf(names.host, sizeof(names.host), "%s", SRP_CLIENT_HOSTNAME);
+		snprintf(names.instance, sizeof(names.instance), "%s", SRP_CLIENT_SERVICE_INSTANCE);
+	}
+
+	names.attempt = attempt;
+}
+
+static void names_save(void)
+{
+	int ret;
+
+	ret = settings_save_one(SETTINGS_KEY, &names, sizeof(names));
+	if (ret) {
+		/* still registered, only the next boot starts over */
+		LOG_WRN("Could not save the SRP names (%d)", ret);
+	}
+}
+
+/* Lock held */
+static otError srp_configure(void)
+{
+	otSrpClientBuffersServiceEntry *entry;
+	uint16_t size;
+	char *string;
+	otError error;
+
+	string = otSrpClientBuffersGetHostNameString(ot, &size);
+	if (strlen(names.host) >= size) {
+		return OT_ERROR_INVALID_ARGS;
+	}
+	strcpy(string, names.host);
+
+	error = otSrpClientSetHostName(ot, string);
+	if (error != OT_ERROR_NONE) {
+		return error;
+	}
+
+	error = otSrpClientEnableAutoHostAddress(ot);
+	if (error != OT_ERROR_NONE) {
+		return error;
+	}
+
+	entry = otSrpClientBuffersAllocateService(ot);
+	if (entry == NULL) {
+		return OT_ERROR_NO_BUFS;
+	}
+
+	string = otSrpClientBuffersGetServiceEntryInstanceNameString(entry, &size);
+	if (strlen(names.instance) >= size) {
+		error = OT_ERROR_INVALID_ARGS;
+		goto end;
+	}
+	strcpy(string, names.instance);
+
+	string = otSrpClientBuffersGetServiceEntryServiceNameString(entry, &size);
+	if (strlen(SRP_SERVICE_NAME) >= size) {
+		error = OT_ERROR_INVALID_ARGS;
+		goto end;
+	}
+	strcpy(string, SRP_SERVICE_NAME);
+
+	entry->mService.mNumTxtEntries = 0;
+	entry->mService.mPort = SERVICE_PORT;
+
+	error = otSrpClientAddService(ot, &entry->mService);
+
+end:
+	if (error != OT_ERROR_NONE) {
+		otSrpClientBuffersFreeService(ot, entry);
+	}
+
+	return error;
+}
+
+/* Runs on the system work queue, on attach and after a duplicate */
+static void register_work_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	bool rename = rename_pending;
+	otError error;
+
+	ARG_UNUSED(work);
+
+	if (rename) {
+		rename_pending = false;
+		names_generate(names.attempt + 1);
+		LOG_INF("SRP names taken, trying %s / %s", names.host, names.instance);
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (rename && configured) {
+		/* the old names never registered, there is nothing to remove on the server */
+		otSrpClientStop(ot);
+		otSrpClientClearHostAndServices(ot);
+		otSrpClientBuffersFreeAllServices(ot);
+		configured = false;
+	}
+
+	if (!configured) {
+		error = srp_configure();
+		if (error != OT_ERROR_NONE) {
+			LOG_ERR("Cannot configure the SRP client (%s)", otThreadErrorToString(error));
+			coap_trace(COAP_TRACE_SRP_FAILED, NULL, 0, error);
+			goto end;
+		}
+		configured = true;
+	} else {
+		/* a server that restarted meanwhile lost us: send a full update now
+		 * instead of waiting for the lease to run out
+		 */
+		otSrpClientStop(ot);
+	}
+
+	/* picks the server out of the network data and starts right away */
+	otSrpClientEnableAutoStartMode(ot, NULL, NULL);
+
+end:
+	openthread_api_mutex_unlock(ot_context);
+
+	if (rename) {
+		names_save();
+	}
+}
+
+/* OpenThread thread */
+static void on_srp_client_updated(otError error, const otSrpClientHostInfo *host_info,
+				  const otSrpClientService *services,
+				  const otSrpClientService *removed_services, void *context)
+{
+	uint32_t jitter;
+
+	ARG_UNUSED(services);
+	ARG_UNUSED(removed_services);
+	ARG_UNUSED(context);
+
+	switch (error) {
+	case OT_ERROR_NONE:
+		if (registered || !attached ||
+		    host_info->mState != OT_SRP_CLIENT_ITEM_STATE_REGISTERED) {
+			break;
+		}
+
+		registered = true;
+		backoff_ms = CONFIG_COAP_SERVER_SRP_BACKOFF_MIN;
+		last_ms = k_uptime_get_32() - attached_at;
+		worst_ms = MAX(worst_ms, last_ms);
+
+		LOG_INF("Registered as %s, %u ms after attach", names.host, last_ms);
+		coap_stats_inc(COAP_STATS_SRP_REGISTRATIONS);
+		boot_phase_mark(BOOT_PHASE_SRP);
+		coap_trace(COAP_TRACE_SRP_REGISTERED, NULL, names.attempt, last_ms);
+		break;
+
+	case OT_ERROR_DUPLICATED:
+		if (rename_pending) {
+			break;
+		}
+
+		/* spread the nodes that collided, and back off if names keep colliding */
+		jitter = sys_rand32_get() % (backoff_ms / 2 + 1);
+		rename_pending = true;
+		coap_stats_inc(COAP_STATS_SRP_DUPLICATES);
+		coap_trace(COAP_TRACE_SRP_DUPLICATE, NULL, names.attempt, backoff_ms + jitter);
+		k_work_reschedule(&register_work, K_MSEC(backoff_ms + jitter));
+		backoff_ms = MIN(backoff_ms * 2, CONFIG_COAP_SERVER_SRP_BACKOFF_MAX);
+		break;
+
+	default:
+		/* the SRP client retries by itself */
+		LOG_WRN("SRP update failed: %s", otThreadErrorToString(error));
+		coap_trace(COAP_TRACE_SRP_FAILED, NULL, 0, error);
+		break;
+	}
+}
+
+/* OpenThread thread */
+static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
+				    void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	if (!(flags & OT_CHANGED_THREAD_ROLE)) {
+		return;
+	}
+
+	switch (otThreadGetDeviceRole(ot_context->instance)) {
+	case OT_DEVICE_ROLE_CHILD:
+	case OT_DEVICE_ROLE_ROUTER:
+	case OT_DEVICE_ROLE_LEADER:
+		/* child to router and back is no re-attach */
+		if (!attached) {
+			attached = true;
+			registered = false;
+			attached_at = k_uptime_get_32();
+			k_work_reschedule(&register_work, K_NO_WAIT);
+		}
+		break;
+
+	case OT_DEVICE_ROLE_DISABLED:
+	case OT_DEVICE_ROLE_DETACHED:
+	default:
+		attached = false;
+		break;
+	}
+}
+
+static struct openthread_state_changed_cb ot_srp_state_changed_cb = {
+	.state_changed_cb = on_thread_state_changed,
+};
+
+int ot_srp_init(otInstance *instance)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	int ret;
+
+	ot = instance;
+	device_id = srp_device_id();
+
+	ret = settings_subsys_init();
+	if (ret == 0) {
+		ret = settings_load_subtree("srp");
+	}
+	if (ret) {
+		LOG_WRN("Could not load the SRP names (%d)", ret);
+	}
+
+	if (!names_loaded) {
+		names_generate(0);
+		names_save();
+	}
+
+	LOG_INF("hostname is: %s", names.host);
+	LOG_INF("service instance is: %s", names.instance);
+
+	openthread_api_mutex_lock(ot_context);
+	otSrpClientSetCallback(ot, on_srp_client_updated, NULL);
+	openthread_api_mutex_unlock(ot_context);
+
+	return openthread_state_changed_cb_register(ot_context, &ot_srp_state_changed_cb);
+}
+
+static int cmd_srp(const struct shell *sh, size_t argc, char **argv)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	const otSrpClientHostInfo *host_info;
+	const char *state;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	openthread_api_mutex_lock(ot_context);
+	host_info = otSrpClientGetHostInfo(ot);
+	state = configured ? otSrpClientItemStateToString(host_info->mState) : "-";
+	openthread_api_mutex_unlock(ot_context);
+
+	shell_print(sh, "host %s, instance %s, %u names taken before", names.host, names.instance,
+		    names.attempt);
+	shell_print(sh, "state %s, %s", state, attached ? "attached" : "detached");
+	if (registered) {
+		shell_print(sh, "registered %u ms after attach, worst %u ms", last_ms, worst_ms);
+	}
+
+	return 0;
+}
+
+static int cmd_srp_forget(const struct shell *sh, size_t argc, char **argv)
+{
+	int ret;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	ret = settings_delete(SETTINGS_KEY);
+	if (ret) {
+		shell_error(sh, "Could not delete the names (%d)", ret);
+		return ret;
+	}
+
+	shell_print(sh, "Names generated again on next boot");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_srp,
+	SHELL_CMD(forget, NULL, "Drop the persisted names", cmd_srp_forget),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((coap), srp, &sub_srp, "Show the SRP registration", cmd_srp, 1, 0);
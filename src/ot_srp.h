@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __OT_SRP_H__
+#define __OT_SRP_H__
+
+#include <openthread/instance.h>
+
+/**@brief Register the host and its service with the SRP server on every
+ * attach, under names kept in settings. A name found taken is replaced and
+ * the new one persisted. Call before openthread_start().
+ */
+int ot_srp_init(otInstance *ot);
+
+#endif
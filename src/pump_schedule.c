@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
+#include <coap_server_client_interface.h>
+
+#include "coap_trace.h"
+#include "pump_schedule.h"
+
+/* Hashed timer wheel with one-second ticks: an entry waits in slot
+ * (expiry % WHEEL_SLOTS) and fires on the revolution its expiry comes up.
+ */
+#define WHEEL_SLOTS 64
+#define DAY_S (24 * 60 * 60)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(WHEEL_SLOTS));
+
+struct wheel_timer {
+	sys_snode_t node;
+	struct pump_schedule_entry entry;
+	/* uptime in seconds */
+	uint32_t expiry;
+};
+
+static struct wheel_timer timers[CONFIG_COAP_SERVER_SCHEDULE_ENTRIES];
+static sys_slist_t wheel[WHEEL_SLOTS];
+/* last tick processed, in seconds of uptime */
+static uint32_t cursor;
+/* seconds to add to the uptime to get the time of day, once known */
+static uint32_t tod_offset;
+static bool tod_known;
+static size_t armed;
+static struct k_timer wheel_tick_timer;
+static struct k_spinlock lock;
+static pump_schedule_run_callback_t on_run;
+
+static uint32_t uptime_s(void)
+{
+	return k_uptime_get() / MSEC_PER_SEC;
+}
+
+/* Seconds until the next occurrence of a time of day, lock held */
+static uint32_t time_of_day_delay(uint32_t time_of_day)
+{
+	uint32_t now = (cursor + tod_offset) % DAY_S;
+
+	return (time_of_day + DAY_S - now) % DAY_S;
+}
+
+/* Lock held. A run due now fires on the next tick. */
+static void wheel_add(struct wheel_timer *timer, uint32_t delay)
+{
+	timer->expiry = cursor + MAX(delay, 1);
+	sys_slist_append(&wheel[timer->expiry % WHEEL_SLOTS], &timer->node);
+}
+
+/* Fires the entries of one slot, returns the longest run due */
+static uint32_t wheel_advance(void)
+{
+	sys_slist_t *slot = &wheel[++cursor % WHEEL_SLOTS];
+	struct wheel_timer *timer, *next;
+	sys_snode_t *prev = NULL;
+	uint32_t run = 0;
+
+	SYS_SLIST_FOR_EACH_CONTAINER_SAFE(slot, timer, next, node) {
+		if (timer->expiry != cursor) {
+			prev = &timer->node;
+			continue;
+		}
+
+		sys_slist_remove(slot, prev, &timer->node);
+		run = MAX(run, timer->entry.duration);
+
+		if (timer->entry.start & SCHEDULE_TIME_OF_DAY) {
+			wheel_add(timer, DAY_S);
+		} else {
+			timer->entry.duration = 0;
+			armed--;
+		}
+	}
+
+	return run;
+}
+
+static void wheel_tick(struct k_timer *timer_id)
+{
+	k_spinlock_key_t key;
+	uint32_t now = uptime_s();
+	uint32_t run = 0;
+
+	ARG_UNUSED(timer_id);
+
+	key = k_spin_lock(&lock);
+	// catch up if the tick came late, no slot is skipped
+	while (cursor != now && armed > 0) {
+		run = MAX(run, wheel_advance());
+	}
+	cursor = now;
+	if (armed == 0) {
+		k_timer_stop(&wheel_tick_timer);
+	}
+	k_spin_unlock(&lock, key);
+
+	if (run > 0) {
+		coap_trace(COAP_TRACE_SCHEDULE_RUN, NULL, armed, run);
+		on_run(run);
+	}
+}
+
+int pump_schedule_set(const struct pump_schedule_entry *entries, size_t count,
+		      int32_t time_of_day)
+{
+	k_spinlock_key_t key;
+
+	if (count > ARRAY_SIZE(timers)) {
+		return -ENOMEM;
+	}
+
+	if (time_of_day >= DAY_S) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t start = entries[i].start;
+
+		if (entries[i].duration == 0) {
+			return -EINVAL;
+		}
+		if ((start & SCHEDULE_TIME_OF_DAY) &&
+		    ((start & ~SCHEDULE_TIME_OF_DAY) >= DAY_S || (time_of_day < 0 && !tod_known))) {
+			return -EINVAL;
+		}
+	}
+
+	key = k_spin_lock(&lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(wheel); i++) {
+		sys_slist_init(&wheel[i]);
+	}
+	memset(timers, 0, sizeof(timers));
+	cursor = uptime_s();
+
+	if (time_of_day >= 0) {
+		tod_offset = (time_of_day + DAY_S - cursor % DAY_S) % DAY_S;
+		tod_known = true;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t start = entries[i].start;
+
+		timers[i].entry = entries[i];
+		wheel_add(&timers[i], (start & SCHEDULE_TIME_OF_DAY) ?
+					      time_of_day_delay(start & ~SCHEDULE_TIME_OF_DAY) :
+					      start);
+	}
+	armed = count;
+
+	if (armed > 0) {
+		k_timer_start(&wheel_tick_timer, K_SECONDS(1), K_SECONDS(1));
+	} else {
+		k_timer_stop(&wheel_tick_timer);
+	}
+
+	k_spin_unlock(&lock, key);
+
+	coap_trace(COAP_TRACE_SCHEDULE_SET, NULL, count, time_of_day);
+
+	return 0;
+}
+
+size_t pump_schedule_get(struct pump_schedule_entry *entries, size_t max)
+{
+	k_spinlock_key_t key;
+	size_t count = 0;
+
+	key = k_spin_lock(&lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(timers) && count < max; i++) {
+		const struct wheel_timer *timer = &timers[i];
+
+		if (timer->entry.duration == 0) {
+			continue;
+		}
+
+		entries[count] = timer->entry;
+		if (!(timer->entry.start & SCHEDULE_TIME_OF_DAY)) {
+			entries[count].start = timer->expiry - cursor;
+		}
+		count++;
+	}
+
+	k_spin_unlock(&lock, key);
+
+	return count;
+}
+
+void pump_schedule_init(pump_schedule_run_callback_t callback)
+{
+	on_run = callback;
+
+	for (size_t i = 0; i < ARRAY_SIZE(wheel); i++) {
+		sys_slist_init(&wheel[i]);
+	}
+
+	k_timer_init(&wheel_tick_timer, wheel_tick, NULL);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __PUMP_SCHEDULE_H__
+#define __PUMP_SCHEDULE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief One pump run, as carried by the /schedule payload. */
+struct pump_schedule_entry {
+	/* seconds since midnight with SCHEDULE_TIME_OF_DAY set, else seconds from now */
+	uint32_t start;
+	/* seconds, never 0 */
+	uint16_t duration;
+};
+
+/**@brief Type definition of the function that starts a pump run.
+ *
+ * Called from the timer ISR, must not block.
+ */
+typedef void (*pump_schedule_run_callback_t)(uint32_t duration_s);
+
+void pump_schedule_init(pump_schedule_run_callback_t on_run);
+
+/**@brief Replace the schedule.
+ *
+ * @param time_of_day seconds since midnight now, negative if unknown. Needed
+ *                    once before time-of-day entries are accepted.
+ *
+ * @retval -ENOMEM more than CONFIG_COAP_SERVER_SCHEDULE_ENTRIES entries.
+ * @retval -EINVAL an entry is out of range, or the time of day is unknown.
+ */
+int pump_schedule_set(const struct pump_schedule_entry *entries, size_t count,
+		      int32_t time_of_day);
+
+/**@brief Copy the pending entries, one-shot ones with the seconds left before they run.
+ *
+ * @return Number of entries copied.
+ */
+size_t pump_schedule_get(struct pump_schedule_entry *entries, size_t max);
+
+#endif
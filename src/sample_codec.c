@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include "sample_codec.h"
+
+static size_t varint_put(uint8_t *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	do {
+		buf[len] = value & 0x7F;
+		value >>= 7;
+		if (value) {
+			buf[len] |= 0x80;
+		}
+		len++;
+	} while (value);
+
+	return len;
+}
+
+static size_t varint_get(const uint8_t *buf, size_t size, uint64_t *value)
+{
+	size_t len = 0;
+
+	*value = 0;
+	while (len < size && len < 10) {
+		*value |= (uint64_t)(buf[len] & 0x7F) << (7 * len);
+		if (!(buf[len++] & 0x80)) {
+			return len;
+		}
+	}
+
+	return 0;
+}
+
+static uint32_t zigzag_encode(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t zigzag_decode(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+size_t sample_record_encode(uint8_t *buf, int64_t prev_ts, const int32_t *prev_val,
+			    int64_t ts, const int32_t *val)
+{
+	size_t len = varint_put(buf, ts - prev_ts);
+
+	for (size_t i = 0; i < SAMPLING_NUM_CHANNELS; i++) {
+		len += varint_put(&buf[len], zigzag_encode(val[i] - prev_val[i]));
+	}
+
+	return len;
+}
+
+size_t sample_record_decode(const uint8_t *buf, size_t size, int64_t *ts, int32_t *val)
+{
+	uint64_t delta;
+	size_t len;
+	size_t n;
+
+	len = varint_get(buf, size, &delta);
+	if (len == 0) {
+		return 0;
+	}
+	*ts += delta;
+
+	for (size_t i = 0; i < SAMPLING_NUM_CHANNELS; i++) {
+		n = varint_get(&buf[len], size - len, &delta);
+		if (n == 0) {
+			return 0;
+		}
+		val[i] += zigzag_decode((uint32_t)delta);
+		len += n;
+	}
+
+	return len;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SAMPLE_CODEC_H__
+#define __SAMPLE_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+/**@brief Worst-case size of an encoded sample: a 64-bit timestamp varint
+ * plus one 32-bit zigzag varint per channel.
+ */
+#define SAMPLE_RECORD_MAX_SIZE (10 + 5 * SAMPLING_NUM_CHANNELS)
+
+/**@brief Encode a sample as deltas from the previous one.
+ *
+ * The timestamp delta [ms] is a varint, each channel delta [mV] a zigzag varint.
+ *
+ * @return number of bytes written to buf.
+ */
+size_t sample_record_encode(uint8_t *buf, int64_t prev_ts, const int32_t *prev_val,
+			    int64_t ts, const int32_t *val);
+
+/**@brief Decode one sample in place over (ts, val).
+ *
+ * @return number of bytes consumed, 0 on a truncated record.
+ */
+size_t sample_record_decode(const uint8_t *buf, size_t size, int64_t *ts, int32_t *val);
+
+#endif
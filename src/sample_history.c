@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "sample_codec.h"
+#include "sample_history.h"
+
+LOG_MODULE_REGISTER(sample_history, CONFIG_SAMPLING_LOG_LEVEL);
+
+#define SEGMENT_COUNT CONFIG_COAP_SERVER_HISTORY_SEGMENTS
+#define SEGMENT_SIZE CONFIG_COAP_SERVER_HISTORY_SEGMENT_SIZE
+
+BUILD_ASSERT(SEGMENT_SIZE >= SAMPLE_RECORD_MAX_SIZE, "History segment too small for one sample");
+
+/* Samples are delta-encoded within a segment. The first sample of each segment
+ * is stored as a delta from zero, so a segment decodes on its own and the
+ * oldest one can be dropped without re-encoding the others.
+ */
+struct history_segment {
+	uint16_t len;
+	uint16_t count;
+	uint8_t data[SEGMENT_SIZE];
+};
+
+static struct history_segment segments[SEGMENT_COUNT];
+/* oldest and newest segment in use */
+static uint8_t tail;
+static uint8_t head;
+static uint32_t sample_count;
+/* segments evicted since boot, the stream shifts each time */
+static uint32_t evicted;
+
+/* last sample appended to the head segment */
+static int64_t head_ts;
+static int32_t head_val[SAMPLING_NUM_CHANNELS];
+
+static K_MUTEX_DEFINE(history_lock);
+
+void sample_history_add(const struct sample_set *set)
+{
+	static const int32_t zero[SAMPLING_NUM_CHANNELS];
+	struct history_segment *seg;
+
+	k_mutex_lock(&history_lock, K_FOREVER);
+
+	seg = &segments[head];
+	if (seg->len + SAMPLE_RECORD_MAX_SIZE > SEGMENT_SIZE) {
+		head = (head + 1) % SEGMENT_COUNT;
+		if (head == tail) {
+			/* full: drop the oldest segment */
+			sample_count -= segments[tail].count;
+			tail = (tail + 1) % SEGMENT_COUNT;
+			evicted++;
+		}
+		seg = &segments[head];
+		seg->len = 0;
+		seg->count = 0;
+	}
+
+	if (seg->count == 0) {
+		seg->len = sample_record_encode(seg->data, 0, zero, set->timestamp, set->val_mv);
+	} else {
+		seg->len += sample_record_encode(&seg->data[seg->len], head_ts, head_val,
+					  set->timestamp, set->val_mv);
+	}
+
+	seg->count++;
+	sample_count++;
+	head_ts = set->timestamp;
+	memcpy(head_val, set->val_mv, sizeof(head_val));
+
+	k_mutex_unlock(&history_lock);
+}
+
+/* Sink that keeps only the [offset, offset + len) window of the stream */
+struct history_stream {
+	size_t pos;
+	size_t offset;
+	uint8_t *buf;
+	size_t len;
+	size_t written;
+};
+
+static void stream_put(struct history_stream *stream, const uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++, stream->pos++) {
+		if (stream->pos >= stream->offset && stream->written < stream->len) {
+			stream->buf[stream->written++] = data[i];
+		}
+	}
+}
+
+size_t sample_history_read(int64_t since_ms, size_t offset, uint8_t *buf, size_t len,
+			   size_t *written, uint32_t *epoch)
+{
+	struct history_stream stream = {
+		.offset = offset,
+		.buf = buf,
+		.len = len,
+	};
+	const uint8_t header[] = { SAMPLE_HISTORY_FORMAT, SAMPLING_NUM_CHANNELS };
+	uint8_t record[SAMPLE_RECORD_MAX_SIZE];
+	int32_t out_val[SAMPLING_NUM_CHANNELS] = { 0 };
+	int64_t out_ts = 0;
+	uint8_t idx;
+
+	stream_put(&stream, header, sizeof(header));
+
+	k_mutex_lock(&history_lock, K_FOREVER);
+
+	*epoch = evicted;
+
+	for (idx = tail;; idx = (idx + 1) % SEGMENT_COUNT) {
+		const struct history_segment *seg = &segments[idx];
+		int32_t val[SAMPLING_NUM_CHANNELS] = { 0 };
+		int64_t ts = 0;
+		size_t pos = 0;
+
+		for (uint16_t n = 0; n < seg->count; n++) {
+			size_t rec_len = sample_record_decode(&seg->data[pos], seg->len - pos, &ts, val);
+
+			if (rec_len == 0) {
+				break;
+			}
+			pos += rec_len;
+
+			if (ts < since_ms) {
+				continue;
+			}
+
+			/* re-encode relative to the previous sample sent, across segments */
+			stream_put(&stream, record, sample_record_encode(record, out_ts, out_val, ts, val));
+			out_ts = ts;
+			memcpy(out_val, val, sizeof(out_val));
+		}
+
+		if (idx == head) {
+			break;
+		}
+	}
+
+	k_mutex_unlock(&history_lock);
+
+	*written = stream.written;
+
+	return stream.pos;
+}
+
+uint32_t sample_history_count(void)
+{
+	return sample_count;
+}
+
+void sample_history_init(void)
+{
+	k_mutex_lock(&history_lock, K_FOREVER);
+	memset(segments, 0, sizeof(segments));
+	head = 0;
+	tail = 0;
+	sample_count = 0;
+	evicted = 0;
+	k_mutex_unlock(&history_lock);
+
+	LOG_INF("History of %d bytes (%d segments)", sizeof(segments), SEGMENT_COUNT);
+}
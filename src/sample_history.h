@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SAMPLE_HISTORY_H__
+#define __SAMPLE_HISTORY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+/**@brief Version byte at the start of a history stream. */
+#define SAMPLE_HISTORY_FORMAT 1
+
+void sample_history_init(void);
+
+/**@brief Append a sample, evicting the oldest segment when the buffer is full. */
+void sample_history_add(const struct sample_set *set);
+
+/**@brief Read a window of the history stream.
+ *
+ * The stream holds every sample taken at or after since_ms (uptime), encoded as:
+ *   u8 format version, u8 channel count, then per sample
+ *   varint timestamp delta [ms] followed by one zigzag varint per channel
+ *   with the value delta [mV]. The first sample is relative to 0.
+ * Appending samples only adds bytes at the end, but evicting the oldest
+ * segment shifts the whole stream. A block-wise reader has to start again
+ * when the epoch changes between two windows.
+ *
+ * @param offset  first byte of the window.
+ * @param buf     window buffer.
+ * @param len     size of the window buffer.
+ * @param written number of bytes written to buf.
+ * @param epoch   number of segments evicted so far, changes with the stream.
+ *
+ * @return total length of the stream.
+ */
+size_t sample_history_read(int64_t since_ms, size_t offset, uint8_t *buf, size_t len,
+			   size_t *written, uint32_t *epoch);
+
+/**@brief Number of samples currently held. */
+uint32_t sample_history_count(void);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/fs/nvs.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/flash_map.h>
+
+#include "sample_codec.h"
+#include "sample_log.h"
+
+LOG_MODULE_REGISTER(sample_log, CONFIG_SAMPLING_LOG_LEVEL);
+
+#define MAX_BATCHES CONFIG_COAP_SERVER_SAMPLE_LOG_MAX_BATCHES
+#define BATCH_DATA_SIZE CONFIG_COAP_SERVER_SAMPLE_LOG_BATCH_SIZE
+#define BATCH_MAX_SIZE (sizeof(struct sample_log_batch_header) + BATCH_DATA_SIZE)
+
+/* NVS ids: the boot counter, then one id per batch slot */
+#define BOOT_ID 0
+#define BATCH_ID(seq) (1 + ((seq) % MAX_BATCHES))
+
+/* NVS allocation table entry written with every batch, and to close a sector */
+#define NVS_ATE_SIZE 8
+
+/* NVS addresses hold the sector number above the offset in the sector */
+#define NVS_ADDR_SECT_SHIFT 16
+#define NVS_ADDR_OFFS_MASK 0xFFFF
+
+BUILD_ASSERT(BATCH_DATA_SIZE >= SAMPLE_RECORD_MAX_SIZE, "Sample log batch too small for one sample");
+
+struct batch {
+	struct sample_log_batch_header header;
+	uint8_t data[BATCH_DATA_SIZE];
+} __packed;
+
+static struct {
+	struct nvs_fs fs;
+	bool mounted;
+	uint16_t boot;
+	/* next batch sequence number to write */
+	uint32_t head;
+	/* length of each stored batch, 0 if the slot is empty */
+	uint8_t len[MAX_BATCHES];
+	/* batch being filled */
+	struct batch pending;
+	int64_t pending_ts;
+	int32_t pending_val[SAMPLING_NUM_CHANNELS];
+	int64_t pending_start;
+	/* batch being read by a cursor */
+	struct batch scratch;
+	/* wear statistics since boot */
+	uint32_t samples;
+	uint32_t batches;
+	uint32_t batch_bytes;
+	uint32_t flash_bytes;
+	uint32_t erases;
+	uint32_t write_errors;
+	uint32_t dropped;
+	/* NVS write sector and bytes used in it after the last write */
+	uint16_t nvs_sector;
+	uint32_t nvs_used;
+} slog;
+
+static K_MUTEX_DEFINE(log_lock);
+
+static uint32_t tail_seq(void)
+{
+	return slog.head > MAX_BATCHES ? slog.head - MAX_BATCHES : 0;
+}
+
+static size_t batch_size(uint32_t seq)
+{
+	uint8_t len = slog.len[seq % MAX_BATCHES];
+
+	return len ? sizeof(struct sample_log_batch_header) + len : 0;
+}
+
+/* Bytes NVS has written to its current sector: data from the bottom, ATEs from the top */
+static uint32_t nvs_sector_used(void)
+{
+	return (slog.fs.data_wra & NVS_ADDR_OFFS_MASK) + slog.fs.sector_size -
+	       (slog.fs.ate_wra & NVS_ADDR_OFFS_MASK);
+}
+
+/* Adds what NVS wrote since the last call, from its write positions. When
+ * it moved to a new sector, it closed the old one, copied the entries still
+ * valid of the next one into the new one (garbage collection) and erased it.
+ */
+static void nvs_wear_update(void)
+{
+	uint16_t sector = slog.fs.ate_wra >> NVS_ADDR_SECT_SHIFT;
+	uint32_t used = nvs_sector_used();
+
+	if (sector != slog.nvs_sector) {
+		slog.flash_bytes += NVS_ATE_SIZE + used;
+		slog.erases++;
+	} else {
+		slog.flash_bytes += used - slog.nvs_used;
+	}
+
+	slog.nvs_sector = sector;
+	slog.nvs_used = used;
+}
+
+static int log_flush_locked(void)
+{
+	size_t size;
+	ssize_t ret;
+
+	if (!slog.mounted || slog.pending.header.count == 0) {
+		return 0;
+	}
+
+	slog.pending.header.seq = slog.head;
+	slog.pending.header.boot = slog.boot;
+	size = sizeof(struct sample_log_batch_header) + slog.pending.header.len;
+
+	/* overwriting the slot of the oldest batch; NVS spreads the writes over the
+	 * whole partition and only erases a sector once it has been filled up
+	 */
+	ret = nvs_write(&slog.fs, BATCH_ID(slog.head), &slog.pending, size);
+	nvs_wear_update();
+	if (ret < 0) {
+		/* the batch is dropped, keeping it would overflow it with the next sample */
+		slog.write_errors++;
+		slog.dropped += slog.pending.header.count;
+		LOG_ERR("Could not write batch %d, %d samples lost (%d)", slog.head,
+			slog.pending.header.count, ret);
+	} else {
+		slog.len[slog.head % MAX_BATCHES] = slog.pending.header.len;
+		slog.head++;
+		slog.batches++;
+		slog.batch_bytes += size;
+	}
+
+	slog.pending.header.count = 0;
+	slog.pending.header.len = 0;
+
+	return ret < 0 ? ret : 0;
+}
+
+/* True if the pending batch has no room for one more sample */
+static bool batch_full(void)
+{
+	const struct sample_log_batch_header *header = &slog.pending.header;
+
+	return header->len + SAMPLE_RECORD_MAX_SIZE > BATCH_DATA_SIZE ||
+	       header->count == UINT8_MAX;
+}
+
+void sample_log_add(const struct sample_set *set)
+{
+	static const int32_t zero[SAMPLING_NUM_CHANNELS];
+	struct sample_log_batch_header *header = &slog.pending.header;
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	if (!slog.mounted) {
+		goto end;
+	}
+
+	if (batch_full()) {
+		/* empty afterwards, written or dropped */
+		(void)log_flush_locked();
+	}
+
+	if (header->count == 0) {
+		header->len = sample_record_encode(slog.pending.data, 0, zero, set->timestamp,
+						   set->val_mv);
+		slog.pending_start = set->timestamp;
+	} else {
+		header->len += sample_record_encode(&slog.pending.data[header->len], slog.pending_ts,
+						    slog.pending_val, set->timestamp, set->val_mv);
+	}
+
+	header->count++;
+	slog.samples++;
+	slog.pending_ts = set->timestamp;
+	memcpy(slog.pending_val, set->val_mv, sizeof(slog.pending_val));
+
+	if (batch_full() ||
+	    set->timestamp - slog.pending_start >=
+		    CONFIG_COAP_SERVER_SAMPLE_LOG_FLUSH_INTERVAL * MSEC_PER_SEC) {
+		(void)log_flush_locked();
+	}
+
+end:
+	k_mutex_unlock(&log_lock);
+}
+
+int sample_log_flush(void)
+{
+	int ret;
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+	ret = log_flush_locked();
+	k_mutex_unlock(&log_lock);
+
+	return ret;
+}
+
+size_t sample_log_cursor_init(struct sample_log_cursor *cursor, size_t offset)
+{
+	size_t total = 0;
+	size_t size;
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	cursor->seq = slog.head;
+	cursor->skip = 0;
+	cursor->tail = tail_seq();
+
+	for (uint32_t seq = tail_seq(); seq < slog.head; seq++) {
+		size = batch_size(seq);
+		if (cursor->seq == slog.head && offset < total + size) {
+			cursor->seq = seq;
+			cursor->skip = offset - total;
+		}
+		total += size;
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	return total;
+}
+
+int sample_log_cursor_read(struct sample_log_cursor *cursor, uint8_t *buf, size_t len)
+{
+	size_t read = 0;
+	size_t size;
+	ssize_t ret;
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	/* batches evicted since the cursor was set are skipped */
+	if (cursor->seq < tail_seq()) {
+		cursor->seq = tail_seq();
+		cursor->skip = 0;
+	}
+
+	while (read < len && cursor->seq < slog.head) {
+		size = batch_size(cursor->seq);
+		if (size <= cursor->skip) {
+			cursor->seq++;
+			cursor->skip = 0;
+			continue;
+		}
+
+		ret = nvs_read(&slog.fs, BATCH_ID(cursor->seq), &slog.scratch, size);
+		if (ret != size || slog.scratch.header.seq != cursor->seq) {
+			LOG_ERR("Batch %d unreadable (%d)", cursor->seq, ret);
+			k_mutex_unlock(&log_lock);
+			return -EIO;
+		}
+
+		size = MIN(size - cursor->skip, len - read);
+		memcpy(&buf[read], (uint8_t *)&slog.scratch + cursor->skip, size);
+		read += size;
+		cursor->skip += size;
+
+		if (cursor->skip == batch_size(cursor->seq)) {
+			cursor->seq++;
+			cursor->skip = 0;
+		}
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	return read;
+}
+
+/* Rebuilds the batch length table from the headers in flash */
+static void log_recover(void)
+{
+	struct sample_log_batch_header header;
+	uint32_t newest = 0;
+	bool found = false;
+	ssize_t ret;
+
+	for (uint32_t slot = 0; slot < MAX_BATCHES; slot++) {
+		ret = nvs_read(&slog.fs, 1 + slot, &header, sizeof(header));
+		if (ret < (ssize_t)sizeof(header) || header.seq % MAX_BATCHES != slot ||
+		    ret != sizeof(header) + header.len) {
+			continue;
+		}
+		slog.len[slot] = header.len;
+		if (!found || header.seq > newest) {
+			newest = header.seq;
+			found = true;
+		}
+	}
+
+	slog.head = found ? newest + 1 : 0;
+
+	/* drop slots that do not belong to the current window */
+	for (uint32_t slot = 0; slot < MAX_BATCHES && found; slot++) {
+		if (slog.len[slot] == 0) {
+			continue;
+		}
+		ret = nvs_read(&slog.fs, 1 + slot, &header, sizeof(header));
+		if (header.seq < tail_seq() || header.seq >= slog.head) {
+			slog.len[slot] = 0;
+		}
+	}
+}
+
+int sample_log_init(void)
+{
+	struct flash_pages_info info;
+	int ret;
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	slog.fs.flash_device = FIXED_PARTITION_DEVICE(sample_log_partition);
+	if (!device_is_ready(slog.fs.flash_device)) {
+		ret = -ENODEV;
+		goto end;
+	}
+
+	slog.fs.offset = FIXED_PARTITION_OFFSET(sample_log_partition);
+	ret = flash_get_page_info_by_offs(slog.fs.flash_device, slog.fs.offset, &info);
+	if (ret) {
+		goto end;
+	}
+
+	slog.fs.sector_size = info.size;
+	slog.fs.sector_count = FIXED_PARTITION_SIZE(sample_log_partition) / info.size;
+
+	ret = nvs_mount(&slog.fs);
+	if (ret) {
+		goto end;
+	}
+
+	if (nvs_read(&slog.fs, BOOT_ID, &slog.boot, sizeof(slog.boot)) != sizeof(slog.boot)) {
+		slog.boot = 0;
+	}
+	slog.boot++;
+	(void)nvs_write(&slog.fs, BOOT_ID, &slog.boot, sizeof(slog.boot));
+
+	log_recover();
+	slog.nvs_sector = slog.fs.ate_wra >> NVS_ADDR_SECT_SHIFT;
+	slog.nvs_used = nvs_sector_used();
+	slog.mounted = true;
+
+	LOG_INF("Sample log: boot %d, batches %d..%d", slog.boot, tail_seq(), slog.head);
+
+end:
+	k_mutex_unlock(&log_lock);
+
+	if (ret) {
+		LOG_ERR("Could not mount sample log (%d)", ret);
+	}
+
+	return ret;
+}
+
+static int cmd_log_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t raw_bytes;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	/* what the samples would take stored raw: timestamp and one value per channel */
+	raw_bytes = slog.samples * (sizeof(int64_t) + sizeof(int32_t) * SAMPLING_NUM_CHANNELS);
+
+	shell_print(sh, "boot %u, batches %u..%u, pending samples %u", slog.boot, tail_seq(),
+		    slog.head, slog.pending.header.count);
+	shell_print(sh, "since boot: %u samples, %u batches of %u bytes, %u write errors, "
+		    "%u samples dropped", slog.samples, slog.batches, slog.batch_bytes,
+		    slog.write_errors, slog.dropped);
+	shell_print(sh, "flash: %u bytes written, %u sector erases", slog.flash_bytes,
+		    slog.erases);
+	/* flash written by NVS (ATEs, sector close and garbage collection copies
+	 * included) per byte of batch
+	 */
+	if (slog.batch_bytes) {
+		shell_print(sh, "write amplification: %u.%02u", slog.flash_bytes / slog.batch_bytes,
+			    (uint32_t)((uint64_t)slog.flash_bytes * 100 / slog.batch_bytes) % 100);
+	}
+	if (raw_bytes) {
+		shell_print(sh, "encoded/raw ratio: %u.%02u", slog.batch_bytes / raw_bytes,
+			    (uint32_t)((uint64_t)slog.batch_bytes * 100 / raw_bytes) % 100);
+	}
+	if (slog.mounted) {
+		shell_print(sh, "flash free: %d bytes", nvs_calc_free_space(&slog.fs));
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	shell_print(sh, "RAM: %u bytes", sizeof(slog));
+
+	return 0;
+}
+
+static int cmd_log_flush(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	return sample_log_flush();
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_log,
+	SHELL_CMD(stats, NULL, "Write amplification, erases and RAM footprint", cmd_log_stats),
+	SHELL_CMD(flush, NULL, "Write the pending batch to flash", cmd_log_flush),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((coap), log, &sub_log, "Persistent sample log", NULL, 1, 0);
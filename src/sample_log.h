@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SAMPLE_LOG_H__
+#define __SAMPLE_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+/**@brief Header of each batch stored in flash, and of each batch in the log stream.
+ *
+ * It is followed by len bytes holding count samples encoded with
+ * sample_record_encode(), the first one relative to zero.
+ */
+struct sample_log_batch_header {
+	/* batch sequence number, never reused */
+	uint32_t seq;
+	/* boot the samples were taken in, their timestamps are uptimes of that boot */
+	uint16_t boot;
+	uint8_t count;
+	uint8_t len;
+} __packed;
+
+/**@brief Position in the log stream, i.e. the stored batches from oldest to newest. */
+struct sample_log_cursor {
+	uint32_t seq;
+	/* bytes of batch seq already consumed */
+	uint16_t skip;
+	/* oldest batch when the cursor was set; the stream offsets shift when it
+	 * changes, so block-wise readers have to start again
+	 */
+	uint32_t tail;
+};
+
+/**@brief Mount the log partition and recover the stored batches. */
+int sample_log_init(void);
+
+/**@brief Append a sample. Flash is only written once a batch is complete. */
+void sample_log_add(const struct sample_set *set);
+
+/**@brief Write the pending batch to flash now. */
+int sample_log_flush(void);
+
+/**@brief Position a cursor at a byte offset of the log stream.
+ *
+ * @return total length of the log stream.
+ */
+size_t sample_log_cursor_init(struct sample_log_cursor *cursor, size_t offset);
+
+/**@brief Read from the cursor position and advance it.
+ *
+ * Only one batch is held in RAM at a time, whatever the log size.
+ *
+ * @return number of bytes read, 0 at the end of the log, negative on error.
+ */
+int sample_log_cursor_read(struct sample_log_cursor *cursor, uint8_t *buf, size_t len);
+
+#endif
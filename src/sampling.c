@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "coap_trace.h"
+#include "sampling.h"
+
+LOG_MODULE_REGISTER(sampling, CONFIG_SAMPLING_LOG_LEVEL);
+
+K_THREAD_STACK_DEFINE(sampling_stack, CONFIG_COAP_SERVER_SAMPLING_STACK_SIZE);
+
+static struct k_work_q sampling_q;
+static struct k_work sample_work;
+static struct k_timer adc_timer;
+
+static sampling_read_callback_t on_sampling_read;
+static sys_slist_t listeners = SYS_SLIST_STATIC_INIT(&listeners);
+
+/* cache, guarded by cache_lock */
+static struct sample_set cache;
+static struct k_spinlock cache_lock;
+
+static void sample_work_handler(struct k_work *work)
+{
+	struct sample_set set = { 0 };
+	struct sampling_listener *listener;
+	k_spinlock_key_t key;
+	int err;
+
+	ARG_UNUSED(work);
+
+	err = on_sampling_read(&set);
+	if (err) {
+		LOG_ERR("Sampling failed (%d)", err);
+		coap_trace(COAP_TRACE_SAMPLE_FAILED, NULL, 0, err);
+		return;
+	}
+
+	set.timestamp = k_uptime_get();
+	set.valid = true;
+
+	key = k_spin_lock(&cache_lock);
+	cache = set;
+	k_spin_unlock(&cache_lock, key);
+
+	coap_trace(COAP_TRACE_SAMPLE, NULL, 0, set.temperature);
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&listeners, listener, node) {
+		listener->on_sample(&set);
+	}
+}
+
+static void on_adc_timer_expiry(struct k_timer *timer_id)
+{
+	ARG_UNUSED(timer_id);
+
+	k_work_submit_to_queue(&sampling_q, &sample_work);
+}
+
+void sampling_listener_register(struct sampling_listener *listener)
+{
+	sys_slist_append(&listeners, &listener->node);
+}
+
+void sampling_get(struct sample_set *set)
+{
+	k_spinlock_key_t key = k_spin_lock(&cache_lock);
+
+	*set = cache;
+	k_spin_unlock(&cache_lock, key);
+}
+
+uint32_t sampling_age_ms(const struct sample_set *set)
+{
+	if (!set->valid) {
+		return UINT32_MAX;
+	}
+
+	return (uint32_t)MIN(k_uptime_get() - set->timestamp, UINT32_MAX);
+}
+
+void sampling_trigger(void)
+{
+	k_work_submit_to_queue(&sampling_q, &sample_work);
+}
+
+int sampling_refresh(void)
+{
+	struct k_work_sync sync;
+	int ret;
+
+	ret = k_work_submit_to_queue(&sampling_q, &sample_work);
+	if (ret < 0) {
+		return ret;
+	}
+
+	k_work_flush(&sample_work, &sync);
+
+	return 0;
+}
+
+int sampling_init(sampling_read_callback_t on_read)
+{
+	if (on_read == NULL) {
+		return -EINVAL;
+	}
+
+	on_sampling_read = on_read;
+
+	k_work_queue_start(&sampling_q, sampling_stack,
+			   K_THREAD_STACK_SIZEOF(sampling_stack),
+			   CONFIG_COAP_SERVER_SAMPLING_PRIORITY, NULL);
+	k_thread_name_set(&sampling_q.thread, "sampling");
+
+	k_work_init(&sample_work, sample_work_handler);
+	k_timer_init(&adc_timer, on_adc_timer_expiry, NULL);
+
+	return 0;
+}
+
+void sampling_start(void)
+{
+	/* first sample right away so the cache is warm before the first request */
+	k_timer_start(&adc_timer, K_NO_WAIT,
+		      K_SECONDS(CONFIG_COAP_SERVER_SAMPLE_PERIOD));
+}
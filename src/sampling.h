@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/slist.h>
+
+/**@brief Number of ADC io-channels listed in the zephyr,user node. */
+#define SAMPLING_NUM_CHANNELS DT_PROP_LEN(DT_PATH(zephyr_user), io_channels)
+
+/**@brief Snapshot of one sampling pass over every ADC channel. */
+struct sample_set {
+	/* uptime (ms) at which the sample was taken */
+	int64_t timestamp;
+	/* per-channel value in mV */
+	int32_t val_mv[SAMPLING_NUM_CHANNELS];
+	/* temperature derived from the channel values, in 0.01 degC */
+	int32_t temperature;
+	/* false until the first successful sample */
+	bool valid;
+};
+
+/**@brief Type definition of the function that performs the ADC conversion.
+ *
+ * Runs on the sampling work queue, never on the OpenThread thread.
+ */
+typedef int (*sampling_read_callback_t)(struct sample_set *set);
+
+/**@brief Consumer of new samples, called on the sampling work queue
+ * after the cache has been updated.
+ */
+struct sampling_listener {
+	sys_snode_t node;
+	void (*on_sample)(const struct sample_set *set);
+};
+
+int sampling_init(sampling_read_callback_t on_read);
+
+/**@brief Register a consumer of new samples. Call before sampling_start(). */
+void sampling_listener_register(struct sampling_listener *listener);
+
+/**@brief Start periodic sampling (period set by CONFIG_COAP_SERVER_SAMPLE_PERIOD). */
+void sampling_start(void);
+
+/**@brief Copy the cached sample. Constant time, safe from any thread. */
+void sampling_get(struct sample_set *set);
+
+/**@brief Age of the cached sample in ms, UINT32_MAX if there is none. */
+uint32_t sampling_age_ms(const struct sample_set *set);
+
+/**@brief Schedule a sample on the sampling work queue without waiting. */
+void sampling_trigger(void);
+
+/**@brief Take a sample now and block until the cache is updated. */
+int sampling_refresh(void);
+
+#endif
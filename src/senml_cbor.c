@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "senml_cbor.h"
+
+/* CBOR major types */
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+
+/* SenML labels */
+#define SENML_BN -2
+#define SENML_BU -4
+#define SENML_N 0
+#define SENML_U 1
+#define SENML_V 2
+#define SENML_VS 3
+#define SENML_VB 4
+#define SENML_T 6
+
+static void cbor_append(struct senml_writer *writer, const void *data, size_t len)
+{
+	if (writer->len + len <= writer->size) {
+		memcpy(&writer->buf[writer->len], data, len);
+	}
+	writer->len += len;
+}
+
+static void cbor_head(struct senml_writer *writer, uint8_t major, uint64_t arg)
+{
+	uint8_t head[9];
+	size_t len;
+
+	head[0] = major << 5;
+	if (arg < 24) {
+		head[0] |= arg;
+		len = 1;
+	} else if (arg <= UINT8_MAX) {
+		head[0] |= 24;
+		head[1] = arg;
+		len = 2;
+	} else if (arg <= UINT16_MAX) {
+		head[0] |= 25;
+		sys_put_be16(arg, &head[1]);
+		len = 3;
+	} else if (arg <= UINT32_MAX) {
+		head[0] |= 26;
+		sys_put_be32(arg, &head[1]);
+		len = 5;
+	} else {
+		head[0] |= 27;
+		sys_put_be64(arg, &head[1]);
+		len = 9;
+	}
+
+	cbor_append(writer, head, len);
+}
+
+static void cbor_int(struct senml_writer *writer, int64_t value)
+{
+	if (value < 0) {
+		cbor_head(writer, CBOR_NINT, (uint64_t)(-1 - value));
+	} else {
+		cbor_head(writer, CBOR_UINT, value);
+	}
+}
+
+static void cbor_text(struct senml_writer *writer, const char *text)
+{
+	size_t len = strlen(text);
+
+	cbor_head(writer, CBOR_TEXT, len);
+	cbor_append(writer, text, len);
+}
+
+void senml_begin(struct senml_writer *writer, uint8_t *buf, size_t size, uint8_t records)
+{
+	writer->buf = buf;
+	writer->size = size;
+	writer->len = 0;
+	cbor_head(writer, CBOR_ARRAY, records);
+}
+
+int senml_end(struct senml_writer *writer)
+{
+	if (writer->len > writer->size) {
+		return -ENOMEM;
+	}
+
+	return writer->len;
+}
+
+void senml_record(struct senml_writer *writer, uint8_t fields)
+{
+	cbor_head(writer, CBOR_MAP, fields);
+}
+
+void senml_base_name(struct senml_writer *writer, const char *name)
+{
+	cbor_int(writer, SENML_BN);
+	cbor_text(writer, name);
+}
+
+void senml_base_unit(struct senml_writer *writer, const char *unit)
+{
+	cbor_int(writer, SENML_BU);
+	cbor_text(writer, unit);
+}
+
+void senml_name(struct senml_writer *writer, const char *name)
+{
+	cbor_int(writer, SENML_N);
+	cbor_text(writer, name);
+}
+
+void senml_unit(struct senml_writer *writer, const char *unit)
+{
+	cbor_int(writer, SENML_U);
+	cbor_text(writer, unit);
+}
+
+void senml_time(struct senml_writer *writer, int64_t time)
+{
+	cbor_int(writer, SENML_T);
+	cbor_int(writer, time);
+}
+
+void senml_value(struct senml_writer *writer, int64_t value)
+{
+	cbor_int(writer, SENML_V);
+	cbor_int(writer, value);
+}
+
+void senml_decimal_value(struct senml_writer *writer, int64_t mantissa, int8_t exponent)
+{
+	cbor_int(writer, SENML_V);
+	cbor_head(writer, CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+	cbor_head(writer, CBOR_ARRAY, 2);
+	cbor_int(writer, exponent);
+	cbor_int(writer, mantissa);
+}
+
+void senml_bool_value(struct senml_writer *writer, bool value)
+{
+	cbor_int(writer, SENML_VB);
+	cbor_head(writer, CBOR_SIMPLE, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void senml_string_value(struct senml_writer *writer, const char *value)
+{
+	cbor_int(writer, SENML_VS);
+	cbor_text(writer, value);
+}
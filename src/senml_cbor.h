@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SENML_CBOR_H__
+#define __SENML_CBOR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief SenML writer (RFC 8428, CBOR representation).
+ *
+ * Items are written into a caller-provided buffer. Like snprintf(), the writer
+ * keeps counting past the end of the buffer, senml_end() then reports the
+ * overflow.
+ */
+struct senml_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+};
+
+void senml_begin(struct senml_writer *writer, uint8_t *buf, size_t size, uint8_t records);
+
+/**@brief Length of the pack, -ENOMEM if it does not fit in the buffer. */
+int senml_end(struct senml_writer *writer);
+
+/**@brief Start a record holding the given number of fields. */
+void senml_record(struct senml_writer *writer, uint8_t fields);
+
+void senml_base_name(struct senml_writer *writer, const char *name);
+void senml_base_unit(struct senml_writer *writer, const char *unit);
+void senml_name(struct senml_writer *writer, const char *name);
+void senml_unit(struct senml_writer *writer, const char *unit);
+void senml_time(struct senml_writer *writer, int64_t time);
+void senml_value(struct senml_writer *writer, int64_t value);
+/**@brief Value of mantissa * 10^exponent, as a CBOR decimal fraction (tag 4). */
+void senml_decimal_value(struct senml_writer *writer, int64_t mantissa, int8_t exponent);
+void senml_bool_value(struct senml_writer *writer, bool value);
+void senml_string_value(struct senml_writer *writer, const char *value);
+
+#endif
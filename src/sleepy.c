@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/link.h>
+#include <openthread/radio_stats.h>
+#include <openthread/thread.h>
+
+#include "coap_stats.h"
+#include "sleepy.h"
+
+LOG_MODULE_REGISTER(sleepy, CONFIG_COAP_SERVER_LOG_LEVEL);
+
+static otInstance *ot;
+static uint32_t csl_period_ms = CONFIG_COAP_SERVER_CSL_PERIOD;
+
+/* OpenThread takes the period in us and refuses anything that is not a
+ * multiple of 160 us: in whole ms, a multiple of 4
+ */
+#define CSL_PERIOD_STEP_MS 4
+
+static uint32_t csl_period_round(uint32_t period_ms)
+{
+	return MAX((period_ms + CSL_PERIOD_STEP_MS / 2) / CSL_PERIOD_STEP_MS * CSL_PERIOD_STEP_MS,
+		   CSL_PERIOD_STEP_MS);
+}
+
+/* Lock held */
+static otError csl_period_apply(uint32_t period_ms)
+{
+	return otLinkSetCslPeriod(ot, period_ms * USEC_PER_MSEC);
+}
+
+int sleepy_init(otInstance *instance)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otLinkModeConfig mode = {
+		.mRxOnWhenIdle = false,
+		.mDeviceType = false,
+		.mNetworkData = false,
+	};
+	otError error;
+
+	ot = instance;
+
+	openthread_api_mutex_lock(ot_context);
+
+	error = otThreadSetLinkMode(ot, mode);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	/* data polls for a parent without CSL, and the keep-alive of one with */
+	if (CONFIG_COAP_SERVER_POLL_PERIOD > 0) {
+		error = otLinkSetPollPeriod(ot, CONFIG_COAP_SERVER_POLL_PERIOD);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	csl_period_ms = csl_period_round(csl_period_ms);
+	error = csl_period_apply(csl_period_ms);
+
+end:
+	openthread_api_mutex_unlock(ot_context);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Cannot configure the sleepy mode (%s)", otThreadErrorToString(error));
+		return -EINVAL;
+	}
+
+	LOG_INF("Sleepy end device, CSL period %u ms", csl_period_ms);
+
+	return 0;
+}
+
+int sleepy_csl_period_set(uint32_t period_ms)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error;
+
+	period_ms = csl_period_round(period_ms);
+
+	openthread_api_mutex_lock(ot_context);
+	error = csl_period_apply(period_ms);
+	if (error == OT_ERROR_NONE) {
+		csl_period_ms = period_ms;
+		otRadioTimeStatsReset(ot);
+	}
+	openthread_api_mutex_unlock(ot_context);
+
+	if (error != OT_ERROR_NONE) {
+		return -EINVAL;
+	}
+
+	coap_stats_reset();
+
+	return 0;
+}
+
+k_timeout_t sleepy_window_delay(void)
+{
+	uint32_t now = k_uptime_get_32();
+
+	/* every response due within a window goes out at its end, in one radio burst */
+	return K_MSEC(CONFIG_COAP_SERVER_SLEEPY_WINDOW - now % CONFIG_COAP_SERVER_SLEEPY_WINDOW);
+}
+
+/* Lock held */
+static uint32_t current_estimate(const otRadioTimeStats *stats)
+{
+	uint64_t idle = stats->mSleepTime + stats->mDisabledTime;
+	uint64_t total = idle + stats->mTxTime + stats->mRxTime;
+	uint64_t charge;
+
+	if (total == 0) {
+		return 0;
+	}
+
+	/* uA * us, the CPU is left out: it sleeps whenever the radio does */
+	charge = stats->mRxTime * CONFIG_COAP_SERVER_RADIO_RX_CURRENT +
+		 stats->mTxTime * CONFIG_COAP_SERVER_RADIO_TX_CURRENT +
+		 idle * CONFIG_COAP_SERVER_SLEEP_CURRENT;
+
+	return charge / total;
+}
+
+void sleepy_report(uint32_t *period_ms, uint32_t *current_ua)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(ot_context);
+	*period_ms = csl_period_ms;
+	*current_ua = current_estimate(otRadioTimeStatsGet(ot));
+	openthread_api_mutex_unlock(ot_context);
+}
+
+static int cmd_csl(const struct shell *sh, size_t argc, char **argv)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otRadioTimeStats stats;
+	uint32_t period_ms;
+	uint64_t total;
+	char *end;
+	int ret;
+
+	if (argc > 1) {
+		period_ms = strtoul(argv[1], &end, 10);
+		if (*end != '\0' || period_ms == 0) {
+			shell_error(sh, "Invalid period %s", argv[1]);
+			return -EINVAL;
+		}
+
+		ret = sleepy_csl_period_set(period_ms);
+		if (ret) {
+			shell_error(sh, "Period refused by OpenThread");
+			return ret;
+		}
+		shell_print(sh, "CSL period %u ms, statistics cleared", csl_period_ms);
+		return 0;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+	stats = *otRadioTimeStatsGet(ot);
+	openthread_api_mutex_unlock(ot_context);
+
+	total = stats.mSleepTime + stats.mDisabledTime + stats.mTxTime + stats.mRxTime;
+	shell_print(sh, "CSL period %u ms, %llu s measured", csl_period_ms, total / USEC_PER_SEC);
+	if (total > 0) {
+		shell_print(sh, "radio rx %llu.%02llu%%, tx %llu.%02llu%%, ~%u uA",
+			    stats.mRxTime * 100 / total, stats.mRxTime * 10000 / total % 100,
+			    stats.mTxTime * 100 / total, stats.mTxTime * 10000 / total % 100,
+			    current_estimate(&stats));
+	}
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((coap), csl, NULL, "Show the radio duty cycle or set the CSL period [ms]",
+		 cmd_csl, 1, 1);
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SLEEPY_H__
+#define __SLEEPY_H__
+
+#include <zephyr/kernel.h>
+#include <openthread/instance.h>
+
+/**@brief Make the node a synchronized sleepy end device with the CSL period of
+ * CONFIG_COAP_SERVER_CSL_PERIOD, rounded like sleepy_csl_period_set(). Call
+ * before openthread_start().
+ */
+int sleepy_init(otInstance *ot);
+
+/**@brief Change the CSL period, in ms, rounded to the nearest multiple of 4 ms
+ * (160 us steps). Statistics are cleared so that what follows describes the
+ * new period only.
+ */
+int sleepy_csl_period_set(uint32_t period_ms);
+
+/**@brief Delay of a response until the next wake window. */
+k_timeout_t sleepy_window_delay(void);
+
+/**@brief CSL period in ms and average current in uA estimated from the radio
+ * time since the last reset, for the statistics report.
+ */
+void sleepy_report(uint32_t *period_ms, uint32_t *current_ua);
+
+#endif
@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/coap.h>
+#include <openthread/dns_client.h>
+#include <openthread/ip6.h>
+#include <openthread/link.h>
+#include <openthread/thread.h>
+#include <coap_server_client_interface.h>
+
+#include "coap_stats.h"
+#include "coap_trace.h"
+#include "sampling.h"
+#include "senml_cbor.h"
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER(telemetry, CONFIG_OT_COAP_UTILS_LOG_LEVEL);
+
+#define RING_SIZE CONFIG_COAP_SERVER_TELEMETRY_BUFFER
+
+/* "urn:dev:mac:" + 16 hex digits + ":" */
+#define BASE_NAME_SIZE 32
+
+/* SenML records of a sample: the temperature, then one per ADC channel */
+#define RECORDS_PER_SAMPLE (1 + SAMPLING_NUM_CHANNELS)
+#define SAMPLES_PER_MESSAGE (CONFIG_COAP_SERVER_TELEMETRY_MAX_RECORDS / RECORDS_PER_SAMPLE)
+
+/* Worst case SenML encoding of a record after the first one: map, n, u, t and v */
+#define RECORD_MAX_SIZE 40
+/* bn of the first record */
+#define PACK_HEADER_SIZE (BASE_NAME_SIZE + 8)
+
+BUILD_ASSERT(SAMPLES_PER_MESSAGE > 0, "Too few telemetry records per message for one sample");
+
+struct telemetry_record {
+	/* uptime in ms */
+	int64_t timestamp;
+	/* 0.01 degC */
+	int32_t temperature;
+	int32_t val_mv[SAMPLING_NUM_CHANNELS];
+};
+
+/* Samples are numbered: the ring holds [first, next), the upload in flight
+ * carries [first, sent_end). Guarded by ring_lock, with uploading and
+ * backoff_s that the sampling listener, the OpenThread callbacks and the
+ * upload work share.
+ */
+static struct telemetry_record ring[RING_SIZE];
+static uint32_t first;
+static uint32_t next;
+static uint32_t sent_end;
+static struct k_spinlock ring_lock;
+
+static otInstance *ot;
+static char base_name[BASE_NAME_SIZE];
+static otSockAddr collector;
+static bool collector_known;
+static bool discovering;
+static bool uploading;
+/* batch interval, doubled after each failed upload */
+static uint32_t backoff_s = CONFIG_COAP_SERVER_TELEMETRY_INTERVAL;
+static uint8_t payload[PACK_HEADER_SIZE +
+		       RECORD_MAX_SIZE * RECORDS_PER_SAMPLE * SAMPLES_PER_MESSAGE];
+
+static void upload_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(upload_work, upload_work_handler);
+
+static uint32_t pending_count(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+	uint32_t count = next - first;
+
+	k_spin_unlock(&ring_lock, key);
+
+	return count;
+}
+
+static bool upload_in_flight(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+	bool in_flight = uploading;
+
+	k_spin_unlock(&ring_lock, key);
+
+	return in_flight;
+}
+
+/* Runs on the sampling work queue */
+static void on_sample(const struct sample_set *set)
+{
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+	uint32_t count, backoff;
+
+	if (next - first == RING_SIZE) {
+		/* the link has been down for long, the oldest sample gives way */
+		first++;
+		coap_stats_inc(COAP_STATS_TELEMETRY_DROPPED);
+	}
+
+	ring[next % RING_SIZE] = (struct telemetry_record){
+		.timestamp = set->timestamp,
+		.temperature = set->temperature,
+	};
+	memcpy(ring[next % RING_SIZE].val_mv, set->val_mv, sizeof(set->val_mv));
+	next++;
+	count = next - first;
+	backoff = backoff_s;
+
+	k_spin_unlock(&ring_lock, key);
+
+	if (count >= CONFIG_COAP_SERVER_TELEMETRY_BATCH &&
+	    backoff == CONFIG_COAP_SERVER_TELEMETRY_INTERVAL) {
+		/* a full batch goes right away, unless the collector is being backed off */
+		k_work_reschedule(&upload_work, K_NO_WAIT);
+	} else {
+		/* no-op if already scheduled: a batch waits at most the interval */
+		k_work_schedule(&upload_work, K_SECONDS(backoff));
+	}
+}
+
+static struct sampling_listener telemetry_listener = {
+	.on_sample = on_sample,
+};
+
+static void upload_failed(void)
+{
+	k_spinlock_key_t key;
+	uint32_t backoff;
+
+	coap_stats_inc(COAP_STATS_TELEMETRY_FAILURES);
+
+	key = k_spin_lock(&ring_lock);
+	uploading = false;
+	backoff_s = MIN(backoff_s * 2, CONFIG_COAP_SERVER_TELEMETRY_BACKOFF_MAX);
+	backoff = backoff_s;
+	k_spin_unlock(&ring_lock, key);
+
+	k_work_reschedule(&upload_work, K_SECONDS(backoff));
+}
+
+/* OpenThread thread */
+static void upload_response_handler(void *context, otMessage *message,
+				    const otMessageInfo *message_info, otError result)
+{
+	k_spinlock_key_t key;
+	uint32_t sent, pending;
+
+	ARG_UNUSED(context);
+	ARG_UNUSED(message_info);
+
+	if (result != OT_ERROR_NONE || otCoapMessageGetCode(message) >> 5 != 2) {
+		coap_trace(COAP_TRACE_TELEMETRY_FAILED, NULL,
+			   result == OT_ERROR_NONE ? otCoapMessageGetCode(message) : 0, result);
+		/* the collector may have moved, look it up again */
+		collector_known = IS_ENABLED(CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR_STATIC);
+		upload_failed();
+		return;
+	}
+
+	key = k_spin_lock(&ring_lock);
+	/* samples dropped meanwhile may have moved first past part of the batch */
+	sent = 0;
+	if ((int32_t)(sent_end - first) > 0) {
+		sent = sent_end - first;
+		first = sent_end;
+	}
+	pending = next - first;
+	uploading = false;
+	backoff_s = CONFIG_COAP_SERVER_TELEMETRY_INTERVAL;
+	k_spin_unlock(&ring_lock, key);
+
+	coap_trace(COAP_TRACE_TELEMETRY_UPLOAD, NULL, sent, pending);
+	coap_stats_inc(COAP_STATS_TELEMETRY_UPLOADS);
+
+	/* a backlog left over from an outage goes out right behind */
+	if (pending >= CONFIG_COAP_SERVER_TELEMETRY_BATCH) {
+		k_work_reschedule(&upload_work, K_NO_WAIT);
+	} else if (pending > 0) {
+		k_work_reschedule(&upload_work, K_SECONDS(CONFIG_COAP_SERVER_TELEMETRY_INTERVAL));
+	}
+}
+
+/* Starts a record of the pack, the first one carries the base name */
+static void record_begin(struct senml_writer *writer, bool first_record, const char *name,
+			 const char *unit, int64_t time)
+{
+	if (first_record) {
+		senml_record(writer, 5);
+		senml_base_name(writer, base_name);
+	} else {
+		senml_record(writer, 4);
+	}
+	senml_name(writer, name);
+	senml_unit(writer, unit);
+	/* relative times (RFC 8428 section 4.5.3): no wall clock needed */
+	senml_time(writer, time);
+}
+
+/* Encodes the oldest pending samples, returns the payload length */
+static int batch_encode(uint32_t *end)
+{
+	struct senml_writer writer;
+	int64_t now = k_uptime_get();
+	k_spinlock_key_t key;
+	uint32_t seq, count;
+	char name[sizeof(SENSORS_ADC_NAME) + 3];
+	int64_t time;
+
+	key = k_spin_lock(&ring_lock);
+
+	/* a longer backlog is left for the next message */
+	count = MIN(next - first, SAMPLES_PER_MESSAGE);
+	senml_begin(&writer, payload, sizeof(payload), count * RECORDS_PER_SAMPLE);
+
+	/* named as in /sensors */
+	for (seq = first; seq < first + count; seq++) {
+		const struct telemetry_record *record = &ring[seq % RING_SIZE];
+
+		time = -(int64_t)((now - record->timestamp) / MSEC_PER_SEC);
+		record_begin(&writer, seq == first, TEMPERATURE_URI_PATH, "Cel", time);
+		senml_decimal_value(&writer, record->temperature, -2);
+
+		for (size_t i = 0; i < SAMPLING_NUM_CHANNELS; i++) {
+			snprintf(name, sizeof(name), SENSORS_ADC_NAME "%d", (int)i);
+			record_begin(&writer, false, name, "mV", time);
+			senml_value(&writer, record->val_mv[i]);
+		}
+	}
+	*end = seq;
+
+	k_spin_unlock(&ring_lock, key);
+
+	return senml_end(&writer);
+}
+
+/* Lock held */
+static otError upload_send(void)
+{
+	otMessageInfo message_info;
+	otMessage *message;
+	otError error = OT_ERROR_NO_BUFS;
+	uint32_t end;
+	int len;
+
+	len = batch_encode(&end);
+	if (len < 0) {
+		return OT_ERROR_NO_BUFS;
+	}
+
+	message = otCoapNewMessage(ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, OT_COAP_TYPE_CONFIRMABLE, OT_COAP_CODE_POST);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+	error = otCoapMessageAppendUriPathOptions(message, CONFIG_COAP_SERVER_TELEMETRY_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendContentFormatOption(message,
+						       OT_COAP_OPTION_CONTENT_FORMAT_SENML_CBOR);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, payload, len);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = collector.mAddress;
+	message_info.mPeerPort = collector.mPort;
+
+	/* OpenThread retransmits with exponential backoff until MAX_TRANSMIT_WAIT */
+	error = otCoapSendRequest(ot, message, &message_info, upload_response_handler, NULL);
+	if (error == OT_ERROR_NONE) {
+		k_spinlock_key_t key = k_spin_lock(&ring_lock);
+
+		sent_end = end;
+		uploading = true;
+		k_spin_unlock(&ring_lock, key);
+	}
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		otMessageFree(message);
+	}
+
+	return error;
+}
+
+#ifndef CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR_STATIC
+static void collector_found(const otDnsServiceInfo *info)
+{
+	char addr_str[OT_IP6_ADDRESS_STRING_SIZE];
+
+	collector.mAddress = info->mHostAddress;
+	collector.mPort = info->mPort;
+	collector_known = true;
+
+	otIp6AddressToString(&collector.mAddress, addr_str, sizeof(addr_str));
+	LOG_INF("Collector at [%s]:%u", addr_str, collector.mPort);
+	coap_trace(COAP_TRACE_TELEMETRY_COLLECTOR, NULL, 0, collector.mPort);
+
+	k_work_reschedule(&upload_work, K_NO_WAIT);
+}
+
+static bool address_unspecified(const otIp6Address *addr)
+{
+	static const otIp6Address unspecified;
+
+	return otIp6IsAddressEqual(addr, &unspecified);
+}
+
+/* OpenThread thread */
+static void resolve_handler(otError error, const otDnsServiceResponse *response, void *context)
+{
+	char host_name[OT_DNS_MAX_NAME_SIZE];
+	otDnsServiceInfo info = {
+		.mHostNameBuffer = host_name,
+		.mHostNameBufferSize = sizeof(host_name),
+	};
+
+	ARG_UNUSED(context);
+
+	discovering = false;
+
+	if (error == OT_ERROR_NONE) {
+		error = otDnsServiceResponseGetServiceInfo(response, &info);
+	}
+
+	if (error != OT_ERROR_NONE || address_unspecified(&info.mHostAddress)) {
+		LOG_WRN("Could not resolve the collector (%s)", otThreadErrorToString(error));
+		upload_failed();
+		return;
+	}
+
+	collector_found(&info);
+}
+
+/* OpenThread thread */
+static void browse_handler(otError error, const otDnsBrowseResponse *response, void *context)
+{
+	char label[OT_DNS_MAX_LABEL_SIZE];
+	char host_name[OT_DNS_MAX_NAME_SIZE];
+	otDnsServiceInfo info = {
+		.mHostNameBuffer = host_name,
+		.mHostNameBufferSize = sizeof(host_name),
+	};
+
+	ARG_UNUSED(context);
+
+	if (error == OT_ERROR_NONE) {
+		/* the first instance will do, there is one collector per network */
+		error = otDnsBrowseResponseGetServiceInstance(response, 0, label, sizeof(label));
+	}
+
+	if (error != OT_ERROR_NONE) {
+		LOG_WRN("No collector found (%s)", otThreadErrorToString(error));
+		discovering = false;
+		upload_failed();
+		return;
+	}
+
+	/* the server may have put the address in the additional records */
+	if (otDnsBrowseResponseGetServiceInfo(response, label, &info) == OT_ERROR_NONE &&
+	    !address_unspecified(&info.mHostAddress)) {
+		discovering = false;
+		collector_found(&info);
+		return;
+	}
+
+	if (otDnsClientResolveService(ot, label, CONFIG_COAP_SERVER_TELEMETRY_SERVICE,
+				      resolve_handler, NULL, NULL) != OT_ERROR_NONE) {
+		discovering = false;
+		upload_failed();
+	}
+}
+
+/* Lock held */
+static otError collector_discover(void)
+{
+	otError error;
+
+	error = otDnsClientBrowse(ot, CONFIG_COAP_SERVER_TELEMETRY_SERVICE, browse_handler, NULL,
+				  NULL);
+	discovering = error == OT_ERROR_NONE;
+
+	return error;
+}
+#else
+static otError collector_discover(void)
+{
+	return OT_ERROR_NOT_FOUND;
+}
+#endif /* CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR_STATIC */
+
+/* Runs on the system work queue */
+static void upload_work_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otDeviceRole role;
+	otError error = OT_ERROR_NONE;
+	bool detached = false;
+
+	ARG_UNUSED(work);
+
+	if (pending_count() == 0) {
+		return;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (upload_in_flight() || discovering) {
+		/* the callback of the exchange in progress takes over */
+		goto end;
+	}
+
+	role = otThreadGetDeviceRole(ot);
+	if (role == OT_DEVICE_ROLE_DISABLED || role == OT_DEVICE_ROLE_DETACHED) {
+		/* keep coalescing, the whole backlog goes in one message once attached */
+		detached = true;
+	} else if (!collector_known) {
+		error = collector_discover();
+	} else {
+		error = upload_send();
+	}
+
+end:
+	openthread_api_mutex_unlock(ot_context);
+
+	if (detached) {
+		k_work_reschedule(&upload_work, K_SECONDS(CONFIG_COAP_SERVER_TELEMETRY_INTERVAL));
+	} else if (error != OT_ERROR_NONE) {
+		upload_failed();
+	}
+}
+
+int telemetry_init(otInstance *instance)
+{
+	const otExtAddress *ext_addr;
+	int len;
+
+	ot = instance;
+
+	/* SenML base name of the records, unique per node */
+	openthread_api_mutex_lock(openthread_get_default_context());
+	ext_addr = otLinkGetExtendedAddress(ot);
+	len = snprintf(base_name, sizeof(base_name), "urn:dev:mac:");
+	for (size_t i = 0; i < sizeof(ext_addr->m8); i++) {
+		len += snprintf(&base_name[len], sizeof(base_name) - len, "%02x", ext_addr->m8[i]);
+	}
+	openthread_api_mutex_unlock(openthread_get_default_context());
+	snprintf(&base_name[len], sizeof(base_name) - len, ":");
+
+#ifdef CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR_STATIC
+	if (otIp6AddressFromString(CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR, &collector.mAddress) !=
+	    OT_ERROR_NONE) {
+		LOG_ERR("Invalid collector address %s", CONFIG_COAP_SERVER_TELEMETRY_COLLECTOR);
+		return -EINVAL;
+	}
+	collector.mPort = CONFIG_COAP_SERVER_TELEMETRY_PORT;
+	collector_known = true;
+#endif
+
+	sampling_listener_register(&telemetry_listener);
+
+	return 0;
+}
+
+static int cmd_telemetry(const struct shell *sh, size_t argc, char **argv)
+{
+	char addr_str[OT_IP6_ADDRESS_STRING_SIZE];
+	k_spinlock_key_t key;
+	uint32_t count, backoff;
+	bool in_flight;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	key = k_spin_lock(&ring_lock);
+	count = next - first;
+	in_flight = uploading;
+	backoff = backoff_s;
+	k_spin_unlock(&ring_lock, key);
+
+	if (collector_known) {
+		otIp6AddressToString(&collector.mAddress, addr_str, sizeof(addr_str));
+		shell_print(sh, "collector [%s]:%u", addr_str, collector.mPort);
+	} else {
+		shell_print(sh, "collector unknown");
+	}
+	shell_print(sh, "%u samples pending, %s, next batch within %u s", count,
+		    in_flight ? "uploading" : "idle", backoff);
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((coap), telemetry, NULL, "Show the telemetry uplink state", cmd_telemetry, 1, 0);
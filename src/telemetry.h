@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <openthread/instance.h>
+
+/**@brief Start batching samples for the collector. Registers a sampling
+ * listener, call before sampling_start().
+ */
+int telemetry_init(otInstance *ot);
+
+#endif
@@ -0,0 +1,114 @@
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""Minimal CoAP (RFC 7252) message encoding, enough for the benchmark tools."""
+
+from collections import namedtuple
+
+TYPE_CON = 0
+TYPE_NON = 1
+TYPE_ACK = 2
+TYPE_RST = 3
+
+CODE_EMPTY = 0
+CODE_GET = 1
+CODE_POST = 2
+CODE_PUT = 3
+CODE_DELETE = 4
+
+OPT_ETAG = 4
+OPT_OBSERVE = 6
+OPT_URI_PATH = 11
+OPT_CONTENT_FORMAT = 12
+OPT_MAX_AGE = 14
+OPT_URI_QUERY = 15
+OPT_ACCEPT = 17
+
+# RFC 7252, 4.8
+ACK_TIMEOUT = 2.0
+ACK_RANDOM_FACTOR = 1.5
+MAX_RETRANSMIT = 4
+MAX_TRANSMIT_WAIT = ACK_TIMEOUT * (2 ** (MAX_RETRANSMIT + 1) - 1) * ACK_RANDOM_FACTOR
+
+Message = namedtuple("Message", "type code mid token options payload")
+
+
+def code_str(code):
+    return "%d.%02d" % (code >> 5, code & 0x1F)
+
+
+def uint_option(value):
+    return value.to_bytes(4, "big").lstrip(b"\0")
+
+
+def path_options(path):
+    return [(OPT_URI_PATH, seg.encode()) for seg in path.strip("/").split("/") if seg]
+
+
+def _option_nibble(value):
+    if value < 13:
+        return value, b""
+    if value < 269:
+        return 13, bytes([value - 13])
+    return 14, (value - 269).to_bytes(2, "big")
+
+
+def encode(mtype, code, mid, token=b"", options=(), payload=b""):
+    data = bytearray([0x40 | (mtype << 4) | len(token), code])
+    data += mid.to_bytes(2, "big")
+    data += token
+
+    last = 0
+    for number, value in sorted(options, key=lambda option: option[0]):
+        delta, delta_ext = _option_nibble(number - last)
+        length, length_ext = _option_nibble(len(value))
+        data.append((delta << 4) | length)
+        data += delta_ext + length_ext + value
+        last = number
+
+    if payload:
+        data.append(0xFF)
+        data += payload
+
+    return bytes(data)
+
+
+def _read_nibble(value, data, pos):
+    if value == 13:
+        return data[pos] + 13, pos + 1
+    if value == 14:
+        return int.from_bytes(data[pos:pos + 2], "big") + 269, pos + 2
+    if value == 15:
+        raise ValueError("reserved option nibble")
+    return value, pos
+
+
+def decode(data):
+    if len(data) < 4 or data[0] >> 6 != 1:
+        raise ValueError("not a CoAP message")
+
+    mtype = (data[0] >> 4) & 0x3
+    tkl = data[0] & 0xF
+    code = data[1]
+    mid = int.from_bytes(data[2:4], "big")
+    token = bytes(data[4:4 + tkl])
+    pos = 4 + tkl
+
+    options = []
+    number = 0
+    payload = b""
+    while pos < len(data):
+        if data[pos] == 0xFF:
+            payload = bytes(data[pos + 1:])
+            break
+        head = data[pos]
+        delta, pos = _read_nibble(head >> 4, data, pos + 1)
+        length, pos = _read_nibble(head & 0xF, data, pos)
+        number += delta
+        options.append((number, bytes(data[pos:pos + length])))
+        pos += length
+
+    return Message(mtype, code, mid, token, options, payload)
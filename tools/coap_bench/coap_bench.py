@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""CoAP load generator for the openthread_coap_server resources.
+
+Sends a weighted mix of CON/NON GET/PUT requests at a fixed rate, with at
+most --concurrency exchanges in flight, and reports latency percentiles,
+loss and retransmissions per request kind.
+
+Mix entries are TYPE-METHOD/PATH[*WEIGHT], for example:
+
+    coap_bench.py -a fd00::1 --mix "non-get/temperature*4,con-get/info,con-put/light"
+
+With --first-response PATH it instead polls PATH with NON GETs from the moment
+it starts until the first 2.05 Content, to measure the time-to-serving of a
+node started at the same time:
+
+    ./build/zephyr/zephyr.exe & coap_bench.py -a fd00::1 --first-response temperature
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import socket
+import sys
+import time
+
+import coap
+
+TYPES = {"con": coap.TYPE_CON, "non": coap.TYPE_NON}
+METHODS = {"get": coap.CODE_GET, "put": coap.CODE_PUT}
+CODE_CONTENT = 0x45
+
+
+class Kind:
+    """One entry of the request mix, with its results."""
+
+    def __init__(self, spec):
+        name, _, weight = spec.partition("*")
+        kind, _, path = name.partition("/")
+        mtype, _, method = kind.partition("-")
+        if mtype not in TYPES or method not in METHODS or not path:
+            raise ValueError("bad mix entry '%s'" % spec)
+
+        self.name = name
+        self.type = TYPES[mtype]
+        self.code = METHODS[method]
+        self.path = path
+        self.weight = float(weight) if weight else 1.0
+        self.sent = 0
+        self.lost = 0
+        self.retransmissions = 0
+        self.codes = {}
+        self.latencies = []
+
+    def summary(self):
+        latencies = sorted(self.latencies)
+        return {
+            "kind": self.name,
+            "sent": self.sent,
+            "answered": len(latencies),
+            "lost": self.lost,
+            "loss_pct": 100.0 * self.lost / self.sent if self.sent else 0.0,
+            "retransmissions": self.retransmissions,
+            "codes": self.codes,
+            "p50_ms": percentile(latencies, 50),
+            "p95_ms": percentile(latencies, 95),
+            "p99_ms": percentile(latencies, 99),
+        }
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of a sorted list, in ms."""
+    if not values:
+        return None
+    rank = max(0, int(round(pct / 100.0 * len(values) + 0.5)) - 1)
+    return 1000.0 * values[min(rank, len(values) - 1)]
+
+
+class Exchange:
+    def __init__(self, kind, mid, token):
+        self.kind = kind
+        self.mid = mid
+        self.token = token
+        self.response = asyncio.get_running_loop().create_future()
+        # set by an empty ACK: the server will send a separate response
+        self.acked = asyncio.Event()
+
+
+class Client(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.transport = None
+        self.by_token = {}
+        self.by_mid = {}
+        self.mid = random.randrange(0x10000)
+        self.token = random.randrange(1 << 32)
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        try:
+            msg = coap.decode(data)
+        except (ValueError, IndexError):
+            return
+
+        if msg.type == coap.TYPE_CON:
+            # separate response: acknowledge it whatever it is
+            self.transport.sendto(coap.encode(coap.TYPE_ACK, coap.CODE_EMPTY, msg.mid))
+
+        if msg.code == coap.CODE_EMPTY:
+            exchange = self.by_mid.get(msg.mid)
+            if exchange is None:
+                return
+            if msg.type == coap.TYPE_RST and not exchange.response.done():
+                exchange.response.set_result(None)
+            elif msg.type == coap.TYPE_ACK:
+                exchange.acked.set()
+            return
+
+        exchange = self.by_token.get(msg.token)
+        if exchange is not None and not exchange.response.done():
+            exchange.response.set_result(msg)
+
+    def next_ids(self):
+        self.mid = (self.mid + 1) & 0xFFFF
+        self.token = (self.token + 1) & 0xFFFFFFFF
+        return self.mid, self.token.to_bytes(4, "big")
+
+
+async def run_exchange(client, kind, args):
+    mid, token = client.next_ids()
+    exchange = Exchange(kind, mid, token)
+    options = coap.path_options(kind.path)
+    payload = args.put_payload.encode() if kind.code == coap.CODE_PUT else b""
+    if args.accept is not None:
+        options.append((coap.OPT_ACCEPT, coap.uint_option(args.accept)))
+    request = coap.encode(kind.type, kind.code, mid, token, options, payload)
+
+    client.by_token[token] = exchange
+    client.by_mid[mid] = exchange
+    kind.sent += 1
+    start = time.monotonic()
+    acked = asyncio.ensure_future(exchange.acked.wait())
+
+    try:
+        client.transport.sendto(request)
+
+        if kind.type == coap.TYPE_CON:
+            # RFC 7252 retransmission with exponential back-off until the
+            # request is acknowledged, then wait for the separate response
+            deadline = start + coap.MAX_TRANSMIT_WAIT
+            timeout = coap.ACK_TIMEOUT * random.uniform(1.0, coap.ACK_RANDOM_FACTOR)
+            for _ in range(coap.MAX_RETRANSMIT):
+                await asyncio.wait([exchange.response, acked], timeout=timeout,
+                                   return_when=asyncio.FIRST_COMPLETED)
+                if exchange.response.done() or acked.done():
+                    break
+                client.transport.sendto(request)
+                kind.retransmissions += 1
+                timeout *= 2
+        else:
+            deadline = start + args.timeout
+
+        remaining = deadline - time.monotonic()
+        msg = await asyncio.wait_for(asyncio.shield(exchange.response), max(remaining, 0))
+    except asyncio.TimeoutError:
+        msg = None
+    finally:
+        acked.cancel()
+        del client.by_token[token]
+        del client.by_mid[mid]
+
+    if msg is None:
+        kind.lost += 1
+        return
+
+    kind.latencies.append(time.monotonic() - start)
+    code = coap.code_str(msg.code)
+    kind.codes[code] = kind.codes.get(code, 0) + 1
+
+
+async def run(args, kinds):
+    loop = asyncio.get_running_loop()
+    family = socket.AF_INET6 if ":" in args.address else socket.AF_INET
+    transport, client = await loop.create_datagram_endpoint(
+        Client, remote_addr=(args.address, args.port), family=family)
+
+    slots = asyncio.Semaphore(args.concurrency)
+    weights = [kind.weight for kind in kinds]
+    tasks = set()
+    late = 0
+    period = 1.0 / args.rate
+    start = time.monotonic()
+    count = int(args.duration * args.rate)
+
+    async def one(kind):
+        try:
+            await run_exchange(client, kind, args)
+        finally:
+            slots.release()
+
+    for i in range(count):
+        # open loop: request i is due at start + i * period
+        delay = start + i * period - time.monotonic()
+        if delay > 0:
+            await asyncio.sleep(delay)
+        if slots.locked():
+            late += 1
+        await slots.acquire()
+        kind = random.choices(kinds, weights)[0]
+        task = asyncio.ensure_future(one(kind))
+        tasks.add(task)
+        task.add_done_callback(tasks.discard)
+
+    if tasks:
+        await asyncio.wait(tasks)
+    elapsed = time.monotonic() - start
+    transport.close()
+
+    return {
+        "target": "[%s]:%d" % (args.address, args.port),
+        "rate": args.rate,
+        "achieved_rate": count / elapsed if elapsed > 0 else 0.0,
+        "concurrency": args.concurrency,
+        "late": late,
+        "duration_s": elapsed,
+        "kinds": [kind.summary() for kind in kinds],
+    }
+
+
+async def run_first_response(args):
+    """Polls args.first_response until the first 2.05, for at most args.duration s."""
+    loop = asyncio.get_running_loop()
+    family = socket.AF_INET6 if ":" in args.address else socket.AF_INET
+    start = time.monotonic()
+    transport, client = await loop.create_datagram_endpoint(
+        Client, remote_addr=(args.address, args.port), family=family)
+
+    kind = Kind("non-get/" + args.first_response)
+    options = coap.path_options(kind.path)
+    first = None
+
+    def on_response(exchange, future):
+        nonlocal first
+        msg = future.result() if not future.cancelled() else None
+        if msg is None:
+            return
+        code = coap.code_str(msg.code)
+        kind.codes[code] = kind.codes.get(code, 0) + 1
+        if msg.code == CODE_CONTENT and first is None:
+            first = time.monotonic() - start
+
+    # every poll is a new exchange, a late answer to an early poll still counts
+    while first is None and time.monotonic() - start < args.duration:
+        mid, token = client.next_ids()
+        exchange = Exchange(kind, mid, token)
+        client.by_token[token] = exchange
+        client.by_mid[mid] = exchange
+        exchange.response.add_done_callback(
+            lambda future, exchange=exchange: on_response(exchange, future))
+        transport.sendto(coap.encode(coap.TYPE_NON, coap.CODE_GET, mid, token, options))
+        kind.sent += 1
+        await asyncio.sleep(args.poll_interval)
+
+    transport.close()
+
+    return {
+        "target": "[%s]:%d" % (args.address, args.port),
+        "path": kind.path,
+        "first_response_ms": 1000.0 * first if first is not None else None,
+        "polls": kind.sent,
+        "poll_interval_ms": 1000.0 * args.poll_interval,
+        "codes": kind.codes,
+    }
+
+
+def print_first_response(report):
+    codes = " ".join("%s:%d" % item for item in sorted(report["codes"].items()))
+    if report["first_response_ms"] is None:
+        print("%s/%s: no 2.05 after %d polls  %s" %
+              (report["target"], report["path"], report["polls"], codes))
+        return
+    print("%s/%s: first 2.05 after %.1f ms (+/- %.1f ms), %d polls  %s" %
+          (report["target"], report["path"], report["first_response_ms"],
+           report["poll_interval_ms"], report["polls"], codes))
+
+
+def print_report(report):
+    def ms(value):
+        return "%8.1f" % value if value is not None else "%8s" % "-"
+
+    print("%s: %.1f req/s (asked %.1f), %d late for a free slot, %.1f s" %
+          (report["target"], report["achieved_rate"], report["rate"], report["late"],
+           report["duration_s"]))
+    print("%-24s %7s %7s %7s %6s %8s %8s %8s  %s" %
+          ("kind", "sent", "lost", "loss%", "retx", "p50 ms", "p95 ms", "p99 ms", "codes"))
+    for kind in report["kinds"]:
+        codes = " ".join("%s:%d" % item for item in sorted(kind["codes"].items()))
+        print("%-24s %7d %7d %7.2f %6d %s %s %s  %s" %
+              (kind["kind"], kind["sent"], kind["lost"], kind["loss_pct"],
+               kind["retransmissions"], ms(kind["p50_ms"]), ms(kind["p95_ms"]),
+               ms(kind["p99_ms"]), codes))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-a", "--address", default="::1",
+                        help="address of the node (default ::1, the loopback stand-in)")
+    parser.add_argument("-p", "--port", type=int, default=5683)
+    parser.add_argument("--mix", default="non-get/temperature*4,con-get/light*2,"
+                        "con-get/info,con-put/light",
+                        help="comma-separated TYPE-METHOD/PATH[*WEIGHT] entries")
+    parser.add_argument("-r", "--rate", type=float, default=10.0, help="requests per second")
+    parser.add_argument("-c", "--concurrency", type=int, default=4,
+                        help="maximum number of exchanges in flight")
+    parser.add_argument("-d", "--duration", type=float, default=30.0, help="seconds")
+    parser.add_argument("-t", "--timeout", type=float, default=5.0,
+                        help="seconds before a NON request counts as lost; CON requests "
+                        "are retransmitted and given up after MAX_TRANSMIT_WAIT")
+    parser.add_argument("--accept", type=int, help="send this Accept option (e.g. 112)")
+    parser.add_argument("--put-payload", default="0",
+                        help="PUT payload (default '0', the pump stays off)")
+    parser.add_argument("--seed", type=int, help="seed of the request mix")
+    parser.add_argument("--json", metavar="FILE", help="also write the report as JSON")
+    parser.add_argument("--first-response", metavar="PATH",
+                        help="poll PATH until the first 2.05 instead of running the mix; "
+                        "gives up after --duration s")
+    parser.add_argument("--poll-interval", type=float, default=0.05,
+                        help="seconds between --first-response polls (default 0.05)")
+    args = parser.parse_args()
+
+    if args.first_response:
+        if args.poll_interval <= 0:
+            parser.error("poll interval must be positive")
+        report = asyncio.run(run_first_response(args))
+        print_first_response(report)
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(report, f, indent=2)
+        return 0 if report["first_response_ms"] is not None else 1
+
+    try:
+        kinds = [Kind(spec) for spec in args.mix.split(",") if spec]
+    except ValueError as err:
+        parser.error(str(err))
+    if args.rate <= 0 or args.concurrency <= 0:
+        parser.error("rate and concurrency must be positive")
+
+    random.seed(args.seed)
+    report = asyncio.run(run(args, kinds))
+    print_report(report)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    return 0 if all(kind["lost"] == 0 for kind in report["kinds"]) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
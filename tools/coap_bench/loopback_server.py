@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""Loopback stand-in for the node, to check coap_bench.py without a network.
+
+Serves /light, /temperature and /info with the raw payloads and message
+types of the firmware: CON requests are answered in the ACK, NON requests
+with a NON response. --delay and --drop emulate a slow or lossy link.
+"""
+
+import argparse
+import asyncio
+import random
+import socket
+
+import coap
+
+CODE_CHANGED = 0x44
+CODE_CONTENT = 0x45
+CODE_NOT_FOUND = 0x84
+CODE_METHOD_NOT_ALLOWED = 0x85
+
+
+class Node:
+    def __init__(self):
+        self.light = 0
+        self.start = asyncio.get_running_loop().time()
+
+    def handle(self, code, path, payload):
+        if path == "light":
+            if code == coap.CODE_PUT and payload:
+                self.light = 1 if payload[:1] == b"1" else 0
+                return CODE_CHANGED, bytes([self.light])
+            return CODE_CONTENT, bytes([self.light])
+        if code != coap.CODE_GET:
+            return CODE_METHOD_NOT_ALLOWED, b""
+        if path == "temperature":
+            # slow triangle between 20 and 30 degC, like the default ADC waveform
+            t = (asyncio.get_running_loop().time() - self.start) % 60
+            return CODE_CONTENT, bytes([int(20 + (t if t < 30 else 60 - t) / 3)])
+        if path == "info":
+            return CODE_CONTENT, b"v1.00"
+        return CODE_NOT_FOUND, b""
+
+
+class Server(asyncio.DatagramProtocol):
+    def __init__(self, args):
+        self.args = args
+        self.node = Node()
+        self.transport = None
+        self.mid = random.randrange(0x10000)
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if random.random() < self.args.drop:
+            return
+        try:
+            msg = coap.decode(data)
+        except (ValueError, IndexError):
+            return
+        if msg.type not in (coap.TYPE_CON, coap.TYPE_NON) or msg.code == coap.CODE_EMPTY:
+            return
+        asyncio.get_running_loop().call_later(self.args.delay / 1000.0, self.respond, msg, addr)
+
+    def respond(self, msg, addr):
+        path = "/".join(value.decode() for number, value in msg.options
+                        if number == coap.OPT_URI_PATH)
+        code, payload = self.node.handle(msg.code, path, msg.payload)
+
+        if msg.type == coap.TYPE_CON:
+            response = coap.encode(coap.TYPE_ACK, code, msg.mid, msg.token, (), payload)
+        else:
+            self.mid = (self.mid + 1) & 0xFFFF
+            response = coap.encode(coap.TYPE_NON, code, self.mid, msg.token, (), payload)
+
+        if random.random() >= self.args.drop:
+            self.transport.sendto(response, addr)
+
+
+async def serve(args):
+    loop = asyncio.get_running_loop()
+    family = socket.AF_INET6 if ":" in args.address else socket.AF_INET
+    await loop.create_datagram_endpoint(lambda: Server(args),
+                                        local_addr=(args.address, args.port), family=family)
+    print("Serving on [%s]:%d" % (args.address, args.port))
+    await asyncio.Event().wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-a", "--address", default="::1")
+    parser.add_argument("-p", "--port", type=int, default=5683)
+    parser.add_argument("--delay", type=float, default=0.0, help="service time in ms")
+    parser.add_argument("--drop", type=float, default=0.0,
+                        help="probability of dropping each request and each response")
+    args = parser.parse_args()
+
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()